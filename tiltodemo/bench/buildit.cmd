@@ -0,0 +1,20 @@
+@rem Builds the benchmarks for the device. Copy them over and run them from a
+@rem shell (novacom run file://bin/sh), they don't need the screen.
+@rem Set the device you want to build for to 1
+set PRE=0
+set PIXI=1
+
+set DEVICEOPTS=
+
+if %PRE% equ 1 (
+   set DEVICEOPTS=-mcpu=cortex-a8 -mfpu=neon -mfloat-abi=softfp
+)
+
+if %PIXI% equ 1 (
+   set DEVICEOPTS=-mcpu=arm1136jf-s -mfpu=vfp -mfloat-abi=softfp
+)
+
+arm-none-linux-gnueabi-g++ %DEVICEOPTS% -O2 -o wallbench wallbench.cpp ..\common\collision.cpp ..\common\geometry.cpp "-I..\common" "-I%PalmPDK%\include" "-I%PalmPDK%\include\SDL" "-L%PalmPDK%\device\lib" -Wl,--allow-shlib-undefined -lSDL
+arm-none-linux-gnueabi-g++ %DEVICEOPTS% -O2 -o trigbench trigbench.cpp ..\common\geometry.cpp "-I..\common" "-I%PalmPDK%\include" "-I%PalmPDK%\include\SDL" "-L%PalmPDK%\device\lib" -Wl,--allow-shlib-undefined -lSDL
+arm-none-linux-gnueabi-g++ %DEVICEOPTS% -O2 -DUSE_OGL=0 -o tickbench tickbench.cpp ..\common\gamelogic.cpp ..\common\collision.cpp ..\common\geometry.cpp ..\common\accelerometer.cpp ..\common\threadpool.cpp ..\common\trigger.cpp ..\common\inputlog.cpp ..\common\levelstream.cpp ..\common\graphics_null.cpp "-I..\common" "-I%PalmPDK%\include" "-I%PalmPDK%\include\SDL" "-L%PalmPDK%\device\lib" -Wl,--allow-shlib-undefined -lSDL
+
@@ -0,0 +1,29 @@
+#!/bin/bash
+
+# Builds the benchmarks for the desktop, to compare against the device
+
+if [ ! "$PalmPDK" ];then
+PalmPDK=/opt/PalmPDK
+fi
+
+CC="g++"
+
+# use the SDL that comes with the PDK if it's there, otherwise
+# whatever SDL 1.2 the machine has (libsdl1.2-dev and libsdl-mixer1.2-dev)
+if [ -d "${PalmPDK}/include" ];then
+INCLUDEDIR="${PalmPDK}/include"
+SDLFLAGS="-I${INCLUDEDIR} -I${INCLUDEDIR}/SDL"
+SDLLIBS="-L${PalmPDK}/host/lib -lSDL"
+else
+SDLFLAGS=`sdl-config --cflags`
+SDLLIBS=`sdl-config --libs`
+fi
+
+# the benchmarks don't draw, so they build without OpenGL
+CPPFLAGS="-O2 -DUSE_OGL=0 -I../common ${SDLFLAGS}"
+
+GAMESRC="../common/gamelogic.cpp ../common/collision.cpp ../common/geometry.cpp ../common/accelerometer.cpp ../common/threadpool.cpp ../common/trigger.cpp ../common/inputlog.cpp ../common/levelstream.cpp ../common/graphics_null.cpp"
+
+$CC $CPPFLAGS -o wallbench wallbench.cpp ../common/collision.cpp ../common/geometry.cpp
+$CC $CPPFLAGS -o trigbench trigbench.cpp ../common/geometry.cpp
+$CC $CPPFLAGS -o tickbench tickbench.cpp $GAMESRC $SDLLIBS -lpthread
@@ -0,0 +1,167 @@
+// A benchmark for the whole physics tick. It sets up the level the same way
+// the game does (see GameLogic::initLevel), but without a screen, sound or
+// any of the art, then runs GameLogic::tick over and over with the
+// accelerometer being tilted around by a script. At the end it prints how
+// many ticks a second we managed, how long each one took, and how many
+// walls (and blocks, see CollideBlockSet) went through the collision test
+// per tick.
+//
+// Nothing here needs a display, so it runs on a plain Linux box, or on the
+// device from a shell. See buildit.cmd and buildit_for_host.sh. GameLogic
+// draws and plays sounds, so it links against graphics_null.cpp, which has
+// do-nothing stand-ins for all of that.
+//
+// With -level, it runs a level from a file instead (see levelstream.h),
+// which loads in pieces around the ball as it goes.
+//
+// usage: tickbench [ticks] [-ms frameMs] [-balls n] [-threads n] [-varstep] [-level file]
+
+#include "SDL.h"
+#include "graphics.h"
+#include "gamelogic.h"
+#include "accelerometer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+static const int DEFAULT_TICKS = 2000000;
+static const int DEFAULT_FRAME_MS = 16;
+
+// the size of the ball in the real art (ball.png is 32x32)
+static const int BALL_RADIUS = 16;
+
+// the script. One full lap of it is this many ticks, and it's worked out
+// before we start so the sin and cos calls don't end up in the timing.
+static const int SCRIPT_LENGTH = 4096;
+static int s_scriptX[SCRIPT_LENGTH];
+static int s_scriptY[SCRIPT_LENGTH];
+
+static void buildScript()
+{
+	// tip the phone around in a slow wobble, with the two axes out of step
+	// so the ball wanders all over the level instead of going back and forth.
+	// Every so often it gets a hard shake, to throw it at the walls fast.
+	for ( int i=0 ; i<SCRIPT_LENGTH ; i++ )
+	{
+		double t = (double)i/SCRIPT_LENGTH*2.0*M_PI;
+		double x = sin(t*3.0);
+		double y = cos(t*5.0);
+		if ( (i & 511) < 16 )
+		{
+			x = (i & 1) ? 1.0 : -1.0;
+		}
+		s_scriptX[i] = (int)(x*32767.0);
+		s_scriptY[i] = (int)(y*32767.0);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	int numTicks = DEFAULT_TICKS;
+	int frameMs = DEFAULT_FRAME_MS;
+	int numBalls = 1;
+	int numThreads = 0;
+	SDL_bool bVarStep = SDL_FALSE;
+	const char *levelFile = NULL;
+	for ( int i=1 ; i<argc ; i++ )
+	{
+		if ( strcmp(argv[i], "-ms") == 0 && i+1 < argc )
+		{
+			frameMs = atoi(argv[++i]);
+		}
+		else if ( strcmp(argv[i], "-balls") == 0 && i+1 < argc )
+		{
+			numBalls = atoi(argv[++i]);
+		}
+		else if ( strcmp(argv[i], "-threads") == 0 && i+1 < argc )
+		{
+			numThreads = atoi(argv[++i]);
+		}
+		else if ( strcmp(argv[i], "-varstep") == 0 )
+		{
+			bVarStep = SDL_TRUE;
+		}
+		else if ( strcmp(argv[i], "-level") == 0 && i+1 < argc )
+		{
+			levelFile = argv[++i];
+		}
+		else
+		{
+			numTicks = atoi(argv[i]);
+		}
+	}
+	if ( numTicks < 1 || frameMs < 1 || numBalls < 1 )
+	{
+		printf("usage: tickbench [ticks] [-ms frameMs] [-balls n] [-threads n] [-varstep] [-level file]\n");
+		return 1;
+	}
+
+	// just the timer. No video, no audio
+	if ( SDL_Init(0) < 0 )
+	{
+		printf("Could not initialize SDL: %s\n", SDL_GetError());
+		return 1;
+	}
+
+	GameLogic *game = new GameLogic();
+	game->m_bHeadless = SDL_TRUE;
+	if ( numBalls > 1 )
+	{
+		game->setNumBalls(numBalls, numThreads);
+	}
+	if ( bVarStep )
+	{
+		game->m_bFixedStep = SDL_FALSE;
+	}
+	game->m_ballRadius = BALL_RADIUS;
+	if ( levelFile != NULL )
+	{
+		game->setLevelFile(levelFile);
+	}
+	updateAccelerometer(ACCELEROMETER_X, 0);
+	updateAccelerometer(ACCELEROMETER_Y, 0);
+	updateAccelerometer(ACCELEROMETER_Z, 0);
+	game->initLevel();
+	buildScript();
+
+	// the game's own totals are only 32 bits, which a long run with lots
+	// of balls goes right past. So we keep our own, from how much they go
+	// up each tick (that works even when they wrap).
+	Uint64 totalWalls = 0;
+	Uint64 totalSteps = 0;
+
+	Uint32 startTicks = SDL_GetTicks();
+	for ( int i=0 ; i<numTicks ; i++ )
+	{
+		int s = i & (SCRIPT_LENGTH-1);
+		updateAccelerometer(ACCELEROMETER_X, s_scriptX[s]);
+		updateAccelerometer(ACCELEROMETER_Y, s_scriptY[s]);
+
+		Uint32 wallsBefore = game->m_totalWallsTested;
+		Uint32 stepsBefore = game->m_totalSteps;
+		game->tick(frameMs);
+		totalWalls += (Uint32)(game->m_totalWallsTested - wallsBefore);
+		totalSteps += (Uint32)(game->m_totalSteps - stepsBefore);
+	}
+	Uint32 elapsed = SDL_GetTicks() - startTicks;
+	if ( elapsed == 0 ) elapsed = 1;
+
+	printf("%d ticks of %d ms, %d balls, %s step\n", numTicks, frameMs, game->m_numBalls, bVarStep ? "variable" : "fixed");
+	printf("%u ms, %.0f ticks per second, %.1f ns per tick\n", elapsed,
+		(double)numTicks*1000.0/(double)elapsed, (double)elapsed*1000000.0/(double)numTicks);
+	printf("%.2f physics steps per tick, %.2f walls tested per tick\n",
+		(double)totalSteps/(double)numTicks, (double)totalWalls/(double)numTicks);
+	printf("%u ticks skipped with the ball asleep\n", game->m_totalSleepTicks);
+	if ( game->m_levelStream.isOpen() )
+	{
+		printf("%u level chunks loaded, waited for %u\n", game->m_levelStream.m_numLoads, game->m_levelStream.m_numWaits);
+	}
+
+	// so a change that moves the ball shows up here too
+	printf("Ball ended at %.17g, %.17g\n", game->m_balls[0].m_pos.m_x, game->m_balls[0].m_pos.m_y);
+
+	delete game;
+	SDL_Quit();
+	return 0;
+}
@@ -0,0 +1,145 @@
+// A benchmark for fastSinCos and fastAtan2 (see geometry.cpp). It checks
+// how far off they are from the math library over a big sweep of angles,
+// and how long each takes, along with rotating a pile of vectors with
+// rotateMany against rotating them one at a time.
+//
+// This doesn't need a screen, so it can run on the device from a shell,
+// or on the desktop. See buildit.cmd and buildit_for_host.sh
+
+#include "SDL.h"
+#include "geometry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+static const int NUM_ANGLES = 100000;
+static const int NUM_PASSES = 100;
+static const int NUM_VECTORS = 1024;
+
+static double s_angles[NUM_ANGLES];
+static double s_xs[NUM_ANGLES];
+static double s_ys[NUM_ANGLES];
+static Vector s_vectors[NUM_VECTORS];
+
+static double getSeconds(clock_t start)
+{
+	return (double)(clock() - start)/CLOCKS_PER_SEC;
+}
+
+int main(int, char **)
+{
+	// angles from -1000 to 1000 radians, and points all the way around
+	// the circle at lots of different distances
+	for ( int i=0 ; i<NUM_ANGLES ; i++ )
+	{
+		s_angles[i] = -1000.0 + 2000.0*i/(NUM_ANGLES - 1);
+		double r = 0.001 + (i % 977)*3.0;
+		s_xs[i] = r*cos(i*0.0137);
+		s_ys[i] = r*sin(i*0.0137);
+	}
+
+	// how far off are they? We also throw in the exact multiples
+	// of pi/4, where the folding changes over.
+	double worstSin = 0.0;
+	double worstCos = 0.0;
+	double worstAtan2 = 0.0;
+	for ( int i=0 ; i<NUM_ANGLES + 16 ; i++ )
+	{
+		double angle = i < NUM_ANGLES ? s_angles[i] : (i - NUM_ANGLES - 8)*0.78539816339744830962;
+		double s, c;
+		fastSinCos(angle, s, c);
+		if ( fabs(s - sin(angle)) > worstSin ) worstSin = fabs(s - sin(angle));
+		if ( fabs(c - cos(angle)) > worstCos ) worstCos = fabs(c - cos(angle));
+
+		double x = i < NUM_ANGLES ? s_xs[i] : cos(angle);
+		double y = i < NUM_ANGLES ? s_ys[i] : sin(angle);
+		double a = fastAtan2(y, x);
+		if ( fabs(a - atan2(y, x)) > worstAtan2 ) worstAtan2 = fabs(a - atan2(y, x));
+	}
+
+	// and how quick
+	double sum = 0.0;
+	clock_t start = clock();
+	for ( int pass=0 ; pass<NUM_PASSES ; pass++ )
+	{
+		for ( int i=0 ; i<NUM_ANGLES ; i++ )
+		{
+			sum += sin(s_angles[i]) + cos(s_angles[i]);
+		}
+	}
+	double secondsLib = getSeconds(start);
+
+	double fastSum = 0.0;
+	start = clock();
+	for ( int pass=0 ; pass<NUM_PASSES ; pass++ )
+	{
+		for ( int i=0 ; i<NUM_ANGLES ; i++ )
+		{
+			double s, c;
+			fastSinCos(s_angles[i], s, c);
+			fastSum += s + c;
+		}
+	}
+	double secondsFast = getSeconds(start);
+
+	double atanSum = 0.0;
+	start = clock();
+	for ( int pass=0 ; pass<NUM_PASSES ; pass++ )
+	{
+		for ( int i=0 ; i<NUM_ANGLES ; i++ )
+		{
+			atanSum += atan2(s_ys[i], s_xs[i]);
+		}
+	}
+	double secondsLibAtan2 = getSeconds(start);
+
+	double fastAtanSum = 0.0;
+	start = clock();
+	for ( int pass=0 ; pass<NUM_PASSES ; pass++ )
+	{
+		for ( int i=0 ; i<NUM_ANGLES ; i++ )
+		{
+			fastAtanSum += fastAtan2(s_ys[i], s_xs[i]);
+		}
+	}
+	double secondsFastAtan2 = getSeconds(start);
+
+	// rotating a pile of vectors by the same small angle, over and over.
+	// One at a time with rotate, then all at once with rotateMany.
+	int numRotations = NUM_PASSES*NUM_ANGLES/NUM_VECTORS;
+	for ( int i=0 ; i<NUM_VECTORS ; i++ )
+	{
+		s_vectors[i].setXY(s_xs[i], s_ys[i]);
+	}
+	start = clock();
+	for ( int pass=0 ; pass<numRotations ; pass++ )
+	{
+		for ( int i=0 ; i<NUM_VECTORS ; i++ )
+		{
+			s_vectors[i].rotate(0.01);
+		}
+	}
+	double secondsRotate = getSeconds(start);
+	double rotateX = s_vectors[0].m_x;
+
+	for ( int i=0 ; i<NUM_VECTORS ; i++ )
+	{
+		s_vectors[i].setXY(s_xs[i], s_ys[i]);
+	}
+	start = clock();
+	for ( int pass=0 ; pass<numRotations ; pass++ )
+	{
+		rotateMany(s_vectors, NUM_VECTORS, 0.01);
+	}
+	double secondsRotateMany = getSeconds(start);
+	double rotateManyX = s_vectors[0].m_x;
+
+	double calls = (double)NUM_PASSES*NUM_ANGLES;
+	double rotations = (double)numRotations*NUM_VECTORS;
+	printf("worst error: sin %.3g, cos %.3g, atan2 %.3g\n", worstSin, worstCos, worstAtan2);
+	printf("sin + cos:   %.2f ns, fastSinCos %.2f ns (%g, %g)\n", secondsLib*1e9/calls, secondsFast*1e9/calls, sum, fastSum);
+	printf("atan2:       %.2f ns, fastAtan2 %.2f ns (%g, %g)\n", secondsLibAtan2*1e9/calls, secondsFastAtan2*1e9/calls, atanSum, fastAtanSum);
+	printf("rotate:      %.2f ns, rotateMany %.2f ns per vector (%g, %g)\n", secondsRotate*1e9/rotations, secondsRotateMany*1e9/rotations, rotateX, rotateManyX);
+	return 0;
+}
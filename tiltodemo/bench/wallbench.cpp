@@ -0,0 +1,344 @@
+// A little benchmark for the collide walls. It runs the same pile of
+// movements against the same pile of walls twice: once with CollideWall,
+// which works out which way each wall runs at runtime, and once with
+// VerticalWall and HorizontalWall (see AxisWall in collision.h), which
+// know it when they're compiled. It checks both come up with exactly the
+// same answers, and prints how long each took. Then it does the AxisWall
+// run again in fixed point (see Fixed in geometry.h), along with a run of
+// applyPPSVel in doubles and in fixed point, one vector at a time and
+// a whole array at a time.
+//
+// Last, it checks CollideWallSet::sweep against the way GameLogic first
+// did it (every CollideWall in the order they were added, each hit cutting
+// the movement short), on the same movements plus a pile aimed right at
+// the corners where the walls of a block meet. Those are where a tie
+// between two walls happens. The wall that wins and the spot where the
+// ball stops have to match to the last bit.
+//
+// This doesn't need a screen, so it can run on the device from a shell,
+// or on the desktop. See buildit.cmd and buildit_for_host.sh
+
+#include "SDL.h"
+#include "collision.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const int NUM_WALLS = 512;
+static const int NUM_MOVES = 4096;
+static const int NUM_PASSES = 20;
+static const int NUM_BOXES = 64;
+static const int NUM_CORNER_MOVES = 4096;
+
+// we want the same walls and movements every time, on every machine,
+// so we bring our own random numbers
+static Uint32 s_seed = 12345;
+static int randomInt(int range)
+{
+	s_seed = s_seed*1103515245 + 12345;
+	return (int)((s_seed >> 16) % (Uint32)range);
+}
+
+static CollideWall s_walls[NUM_WALLS];
+static VerticalWall s_verticals[NUM_WALLS];
+static HorizontalWall s_horizontals[NUM_WALLS];
+static FixedVerticalWall s_fixedVerticals[NUM_WALLS];
+static FixedHorizontalWall s_fixedHorizontals[NUM_WALLS];
+static int s_numVerticals = 0;
+static int s_numHorizontals = 0;
+static Vector s_starts[NUM_MOVES];
+static Vector s_ends[NUM_MOVES];
+static FixedVector s_fixedStarts[NUM_MOVES];
+static FixedVector s_fixedEnds[NUM_MOVES];
+
+// the walls of some blocks, for the corner movements, after the scattered
+// ones. Each box is four walls, the same as GameLogic made them for a block.
+static CollideWall s_boxWalls[NUM_BOXES*4];
+static CollideWallSet s_wallSet;
+static Vector s_cornerStarts[NUM_CORNER_MOVES];
+static Vector s_cornerEnds[NUM_CORNER_MOVES];
+
+static double getSeconds(clock_t start)
+{
+	return (double)(clock() - start)/CLOCKS_PER_SEC;
+}
+
+// the first hit the old way: every wall, in order, and each hit cuts the 
+// movement short for the ones after it. Returns the wall, or -1.
+static int sweepOld(Vector &start, Vector &end, Vector &result)
+{
+	Vector wantPos;
+	wantPos.set(end);
+	int collidedWith = -1;
+	Vector postCollision;
+	for ( int i=0 ; i<NUM_WALLS+NUM_BOXES*4 ; i++ )
+	{
+		CollideWall &wall = i < NUM_WALLS ? s_walls[i] : s_boxWalls[i-NUM_WALLS];
+		if ( wall.checkCollision(start, wantPos, postCollision) )
+		{
+			wantPos.set(postCollision);
+			collidedWith = i;
+		}
+	}
+	result.set(wantPos);
+	return collidedWith;
+}
+
+// checks CollideWallSet::sweep against sweepOld for some movements.
+// Returns how many came out different.
+static int compareSweeps(Vector *starts, Vector *ends, int count)
+{
+	// every wall is a candidate
+	Uint32 candidates[CollideWallSet::MASK_WORDS];
+	memset(candidates, 0xFF, sizeof(candidates));
+
+	int numBad = 0;
+	for ( int m=0 ; m<count ; m++ )
+	{
+		Vector resultOld, resultNew;
+		int wallOld = sweepOld(starts[m], ends[m], resultOld);
+		int wallNew = s_wallSet.sweep(starts[m], ends[m], candidates, resultNew);
+		if ( wallOld != wallNew || 
+			 memcmp(&resultOld.m_x, &resultNew.m_x, sizeof(double)) != 0 ||
+			 memcmp(&resultOld.m_y, &resultNew.m_y, sizeof(double)) != 0 )
+		{
+			if ( numBad < 5 )
+			{
+				printf("sweep %d: wall %d at %.17g, %.17g, but it was wall %d at %.17g, %.17g\n", m,
+					   wallNew, resultNew.m_x, resultNew.m_y, wallOld, resultOld.m_x, resultOld.m_y);
+			}
+			numBad++;
+		}
+	}
+	return numBad;
+}
+
+int main(int, char **)
+{
+	// scatter the walls over a screen sized area, half of each kind
+	for ( int i=0 ; i<NUM_WALLS ; i++ )
+	{
+		int x = randomInt(320);
+		int y = randomInt(480);
+		int length = 8 + randomInt(100);
+		int push = randomInt(2) ? 1 : -1;
+		if ( i & 1 )
+		{
+			s_walls[i].initHorizontal(x, y, length, push);
+			s_fixedHorizontals[s_numHorizontals].init(x, y, length, push);
+			s_horizontals[s_numHorizontals++].init(x, y, length, push);
+		}
+		else
+		{
+			s_walls[i].initVertical(x, y, length, push);
+			s_fixedVerticals[s_numVerticals].init(x, y, length, push);
+			s_verticals[s_numVerticals++].init(x, y, length, push);
+		}
+	}
+
+	// the boxes, outset by a ball's radius the way the blocks used to be,
+	// so their walls meet at the corners
+	for ( int i=0 ; i<NUM_BOXES ; i++ )
+	{
+		int x = randomInt(280);
+		int y = randomInt(440);
+		int w = 8 + randomInt(60);
+		int h = 8 + randomInt(60);
+		s_boxWalls[i*4].initVertical(x, y, h, -1);
+		s_boxWalls[i*4+1].initVertical(x+w, y, h, 1);
+		s_boxWalls[i*4+2].initHorizontal(x, y, w, -1);
+		s_boxWalls[i*4+3].initHorizontal(x, y+h, w, 1);
+
+		// and movements coming in at its corners on a diagonal, which 
+		// cross both walls at exactly the same spot
+		for ( int c=0 ; c<NUM_CORNER_MOVES/NUM_BOXES ; c++ )
+		{
+			int m = i*(NUM_CORNER_MOVES/NUM_BOXES) + c;
+			int cornerX = (c & 1) ? x+w : x;
+			int cornerY = (c & 2) ? y+h : y;
+			double reach = 1 + randomInt(16)/4.0;
+			double dirX = (c & 4) ? 1.0 : -1.0;
+			double dirY = (c & 8) ? 1.0 : -1.0;
+			s_cornerStarts[m].setXY(cornerX - dirX*reach, cornerY - dirY*reach);
+			s_cornerEnds[m].setXY(cornerX + dirX*reach, cornerY + dirY*reach);
+		}
+	}
+
+	// all of them in a CollideWallSet, in the same order
+	for ( int i=0 ; i<NUM_WALLS+NUM_BOXES*4 ; i++ )
+	{
+		CollideWall &wall = i < NUM_WALLS ? s_walls[i] : s_boxWalls[i-NUM_WALLS];
+		int push = wall.m_push > 0 ? 1 : -1;
+		if ( wall.m_bIsVertical )
+		{
+			s_wallSet.addVertical((int)wall.m_x, (int)wall.m_y, (int)wall.m_size, push);
+		}
+		else
+		{
+			s_wallSet.addHorizontal((int)wall.m_x, (int)wall.m_y, (int)wall.m_size, push);
+		}
+	}
+
+	// and the movements. About as far as a ball goes in a frame or two
+	for ( int i=0 ; i<NUM_MOVES ; i++ )
+	{
+		s_starts[i].setXY(randomInt(320*4)/4.0, randomInt(480*4)/4.0);
+		s_ends[i].setXY(s_starts[i].m_x + (randomInt(160) - 80)/4.0, s_starts[i].m_y + (randomInt(160) - 80)/4.0);
+
+		// quarter pixels come out exact in fixed point
+		s_fixedStarts[i].setXY(s_starts[i].m_x, s_starts[i].m_y);
+		s_fixedEnds[i].setXY(s_ends[i].m_x, s_ends[i].m_y);
+	}
+
+	// the old way
+	int hitsOld = 0;
+	double sumOld = 0.0;
+	clock_t start = clock();
+	for ( int pass=0 ; pass<NUM_PASSES ; pass++ )
+	{
+		for ( int m=0 ; m<NUM_MOVES ; m++ )
+		{
+			Vector result;
+			for ( int i=0 ; i<NUM_WALLS ; i++ )
+			{
+				if ( s_walls[i].checkCollision(s_starts[m], s_ends[m], result) )
+				{
+					s_walls[i].push(result);
+					hitsOld++;
+					sumOld += result.m_x + result.m_y;
+				}
+			}
+		}
+	}
+	double secondsOld = getSeconds(start);
+
+	// the new way. The walls are in a different order, but every wall
+	// is still tested against every movement, so the totals should match.
+	int hitsNew = 0;
+	double sumNew = 0.0;
+	start = clock();
+	for ( int pass=0 ; pass<NUM_PASSES ; pass++ )
+	{
+		for ( int m=0 ; m<NUM_MOVES ; m++ )
+		{
+			Vector result;
+			for ( int i=0 ; i<s_numVerticals ; i++ )
+			{
+				if ( s_verticals[i].checkCollision(s_starts[m], s_ends[m], result) )
+				{
+					s_verticals[i].push(result);
+					hitsNew++;
+					sumNew += result.m_x + result.m_y;
+				}
+			}
+			for ( int i=0 ; i<s_numHorizontals ; i++ )
+			{
+				if ( s_horizontals[i].checkCollision(s_starts[m], s_ends[m], result) )
+				{
+					s_horizontals[i].push(result);
+					hitsNew++;
+					sumNew += result.m_x + result.m_y;
+				}
+			}
+		}
+	}
+	double secondsNew = getSeconds(start);
+
+	// the new way again, in fixed point. The hits can be off by one here
+	// and there, from where the rounding lands on a wall's end.
+	int hitsFixed = 0;
+	start = clock();
+	for ( int pass=0 ; pass<NUM_PASSES ; pass++ )
+	{
+		for ( int m=0 ; m<NUM_MOVES ; m++ )
+		{
+			FixedVector result;
+			for ( int i=0 ; i<s_numVerticals ; i++ )
+			{
+				if ( s_fixedVerticals[i].checkCollision(s_fixedStarts[m], s_fixedEnds[m], result) )
+				{
+					s_fixedVerticals[i].push(result);
+					hitsFixed++;
+				}
+			}
+			for ( int i=0 ; i<s_numHorizontals ; i++ )
+			{
+				if ( s_fixedHorizontals[i].checkCollision(s_fixedStarts[m], s_fixedEnds[m], result) )
+				{
+					s_fixedHorizontals[i].push(result);
+					hitsFixed++;
+				}
+			}
+		}
+	}
+	double secondsFixed = getSeconds(start);
+
+	// and applyPPSVel, moving every start by its movement as a velocity for 
+	// a 120th of a second, which is what a fixed step does
+	double ms = 1000.0/120.0;
+	Fixed fixedMs = ms;
+	Vector moved;
+	FixedVector fixedMoved;
+	double sumMoved = 0.0;
+	Sint64 sumFixedMoved = 0; // raw, so it doesn't wrap
+	start = clock();
+	for ( int pass=0 ; pass<NUM_PASSES*NUM_WALLS/16 ; pass++ )
+	{
+		for ( int m=0 ; m<NUM_MOVES ; m++ )
+		{
+			applyPPSVel(s_starts[m], s_ends[m], ms, moved);
+			sumMoved += moved.m_x;
+		}
+	}
+	double secondsMove = getSeconds(start);
+	start = clock();
+	for ( int pass=0 ; pass<NUM_PASSES*NUM_WALLS/16 ; pass++ )
+	{
+		for ( int m=0 ; m<NUM_MOVES ; m++ )
+		{
+			applyPPSVel(s_fixedStarts[m], s_fixedEnds[m], fixedMs, fixedMoved);
+			sumFixedMoved += fixedMoved.m_x.m_raw;
+		}
+	}
+	double secondsFixedMove = getSeconds(start);
+
+	// the batch version, on the whole array in one call
+	static Vector s_moved[NUM_MOVES];
+	double sumBatchMoved = 0.0;
+	start = clock();
+	for ( int pass=0 ; pass<NUM_PASSES*NUM_WALLS/16 ; pass++ )
+	{
+		applyPPSVel(s_starts, s_ends, ms, s_moved, NUM_MOVES);
+		sumBatchMoved += s_moved[pass % NUM_MOVES].m_x;
+	}
+	double secondsBatchMove = getSeconds(start);
+
+	double tests = (double)NUM_PASSES*NUM_MOVES*NUM_WALLS;
+	double moves = (double)NUM_PASSES*NUM_WALLS/16*NUM_MOVES;
+	printf("CollideWall:  %d hits, %.3f s, %.2f ns per wall\n", hitsOld, secondsOld, secondsOld*1e9/tests);
+	printf("AxisWall:     %d hits, %.3f s, %.2f ns per wall\n", hitsNew, secondsNew, secondsNew*1e9/tests);
+	printf("Fixed:        %d hits, %.3f s, %.2f ns per wall\n", hitsFixed, secondsFixed, secondsFixed*1e9/tests);
+	printf("applyPPSVel:  double %.2f ns, Fixed %.2f ns per vector (%g, %g)\n", secondsMove*1e9/moves, secondsFixedMove*1e9/moves, 
+		   sumMoved, (double)sumFixedMoved/Fixed::ONE);
+	printf("batch:        double %.2f ns per vector (%g)\n", secondsBatchMove*1e9/moves, sumBatchMoved);
+
+	// the sums are just for eyeballing. The hits get added up in a
+	// different order, which can change the last few digits.
+	if ( hitsOld != hitsNew )
+	{
+		printf("MISMATCH: the two kinds of wall disagree\n");
+		return 1;
+	}
+	printf("results match (%.6f / %.6f)\n", sumOld, sumNew);
+
+	// the first hits have to match exactly, not just the totals
+	int badSweeps = compareSweeps(s_starts, s_ends, NUM_MOVES) + compareSweeps(s_cornerStarts, s_cornerEnds, NUM_CORNER_MOVES);
+	if ( badSweeps != 0 )
+	{
+		printf("MISMATCH: %d sweeps hit a different wall, or stopped somewhere else\n", badSweeps);
+		return 1;
+	}
+	printf("sweeps match, wall for wall and bit for bit (%d movements)\n", NUM_MOVES + NUM_CORNER_MOVES);
+	return 0;
+}
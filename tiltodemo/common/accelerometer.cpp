@@ -8,6 +8,11 @@ double s_accX;
 double s_accY;
 double s_accZ;
 
+// what watchAccelerometer is watching for
+double s_watch[3];
+double s_watchThreshold = 0.0;
+SDL_bool s_bMoved = SDL_FALSE;
+
 SDL_Joystick *gJoystick;
 
 void accelerometer_init()
@@ -65,6 +70,30 @@ void updateAccelerometer(int accelerometer, int value)
 		case ACCELEROMETER_Y: s_accY = dVal; break;
 		case ACCELEROMETER_Z: s_accZ = dVal; break;
 	}
+
+	// is this the one that wakes the game up?
+	if ( s_watchThreshold > 0.0 && accelerometer >= 0 && accelerometer < 3 )
+	{
+		double moved = dVal - s_watch[accelerometer];
+		if ( moved > s_watchThreshold || moved < -s_watchThreshold )
+		{
+			s_bMoved = SDL_TRUE;
+		}
+	}
+}
+
+void watchAccelerometer(double threshold)
+{
+	s_watch[ACCELEROMETER_X] = s_accX;
+	s_watch[ACCELEROMETER_Y] = s_accY;
+	s_watch[ACCELEROMETER_Z] = s_accZ;
+	s_watchThreshold = threshold;
+	s_bMoved = SDL_FALSE;
+}
+
+SDL_bool accelerometerMoved()
+{
+	return s_bMoved;
 }
 
 
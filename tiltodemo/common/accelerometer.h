@@ -14,5 +14,12 @@ double getAccelerometerY();
 double getAccelerometerZ();
 void updateAccelerometer(int accelerometer, int value);
 
+// for waking up a sleeping game (see GameLogic::tick). watchAccelerometer
+// notes where the accelerometer is now, and accelerometerMoved returns true
+// once any of it has moved more than threshold away from there. A threshold
+// of 0 stops watching.
+void watchAccelerometer(double threshold);
+SDL_bool accelerometerMoved();
+
 #endif
 
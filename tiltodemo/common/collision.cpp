@@ -1,38 +1,13 @@
 #include "SDL.h"
 #include "collision.h"
+#include <math.h>
 
 // In general, this file is not as heavily commented as other files
 // in this sample app. The purpose of the sample app is to demonstrate
 // the proper use of SDL and SDL concepts, not to teach you how to do
 // collision detection. 
 
-CollideWall::CollideWall()
-{
-}
-
-CollideWall::~CollideWall()
-{
-}
-
-void CollideWall::initVertical(int x, int y, int height, int push)
-{
-	m_bIsVertical = SDL_TRUE;
-	m_x = x;
-	m_y = y;
-	m_size = height;
-	setPush(push);
-}
-
-void CollideWall::initHorizontal(int x, int y, int length, int push)
-{
-	m_bIsVertical = SDL_FALSE;
-	m_x = x;
-	m_y = y;
-	m_size = length;
-	setPush(push);
-}
-
-void CollideWall::setPush(int push)
+static double getPushAmount(int push)
 {
 	// we push just a quarter pixel. That way
 	// the pushed item will display in the same location,
@@ -40,22 +15,21 @@ void CollideWall::setPush(int push)
 	// line of collision.
 	if ( push > 0 )
 	{
-		m_push = 0.25;
+		return 0.25;
 	}
 	else if ( push < 0 )
 	{
-		m_push = -0.25;
-	}
-	else
-	{
-		// really shouldn't do this. There should always
-		// be a push. But ok, if they send in 0, they get
-		// no push
-		m_push = 0.0;
+		return -0.25;
 	}
+
+	// really shouldn't do this. There should always
+	// be a push. But ok, if they send in 0, they get
+	// no push
+	return 0.0;
 }
 
-SDL_bool CollideWall::checkCollision(Vector &start, Vector &end, Vector &result)
+template <typename T>
+SDL_bool checkWallCollision(SDL_bool bIsVertical, T x, T y, T size, BasicVector<T> &start, BasicVector<T> &end, BasicVector<T> &result)
 {
 	// return true if there was a collision. result will have the 
 	// point of collision put in to it. In the event that there
@@ -71,15 +45,15 @@ SDL_bool CollideWall::checkCollision(Vector &start, Vector &end, Vector &result)
 	// sides of us. For verticals, that means the x's of the start and
 	// end need to be on opposite sides of our x. For horizontals, that
 	// means the y's have to be on opposite sides of our y
-	if ( m_bIsVertical )
+	if ( bIsVertical )
 	{
 		// vertical. Are the x's on different sides? If not, there can't be a collision
-		if ( !isMiddle(start.m_x, m_x, end.m_x) ) return SDL_FALSE;
+		if ( !isMiddle(start.m_x, x, end.m_x) ) return SDL_FALSE;
 	}
 	else
 	{
 		// horizontal. Are the y's on different sides? If not, there can't be a collision
-		if ( !isMiddle(start.m_y, m_y, end.m_y) ) return SDL_FALSE;
+		if ( !isMiddle(start.m_y, y, end.m_y) ) return SDL_FALSE;
 	}
 
 	// if we're here, it means the movement vector will cross over the
@@ -89,22 +63,22 @@ SDL_bool CollideWall::checkCollision(Vector &start, Vector &end, Vector &result)
 	// can't possible intersect. So if y values are both above our vertical, or 
 	// both below it, they can't intersect. OR if both x's are to the left of our 
 	// horizontal, or both to the right of it, they can't intersect.
-	if ( m_bIsVertical )
+	if ( bIsVertical )
 	{
 		// are both y values above us?
-		if ( (start.m_y<m_y) && (end.m_y<m_y) ) return SDL_FALSE;
+		if ( (start.m_y<y) && (end.m_y<y) ) return SDL_FALSE;
 
 		// below us?
-		double bottomY = start.m_y + m_size;
+		T bottomY = start.m_y + size;
 		if ( (start.m_y>bottomY) && (end.m_y>bottomY) ) return SDL_FALSE;
 	}
 	else
 	{
 		// are both x values left of us?
-		if ( (start.m_x<m_x) && (end.m_x<m_x) ) return SDL_FALSE;
+		if ( (start.m_x<x) && (end.m_x<x) ) return SDL_FALSE;
 
 		// to the right of us?
-		double rightX = start.m_x + m_size;
+		T rightX = start.m_x + size;
 		if ( (start.m_x>rightX) && (end.m_x>rightX) ) return SDL_FALSE;
 	}
 
@@ -117,39 +91,89 @@ SDL_bool CollideWall::checkCollision(Vector &start, Vector &end, Vector &result)
 	// simple math, but we don't want to do it for every single collision segment in 
 	// the world every game loop, hence the above filtering.
 
-	double dx = end.m_x - start.m_x;
-	double dy = end.m_y - start.m_y;
-	if ( m_bIsVertical )
+	T dx = end.m_x - start.m_x;
+	T dy = end.m_y - start.m_y;
+	if ( bIsVertical )
 	{
+		// moving straight along our line? That's not crossing it. (in doubles,
+		// the divide below would give us a NaN, which fails the next test anyway. 
+		// In fixed point, it'd crash)
+		if ( dx == 0 ) return SDL_FALSE;
+
 		// we're a vertical collision segment. 
-		double x = m_x - start.m_x; // distance from the start point to us.
-		double y = start.m_y + (x*dy)/dx; // this will be the y value of the movement line where it intersects our line.
+		T distX = x - start.m_x; // distance from the start point to us.
+		T hitY = start.m_y + (distX*dy)/dx; // this will be the y value of the movement line where it intersects our line.
 
 		// is that y value within our start and end y values?
-		if ( !isMiddle(m_y, y, m_y+m_size) ) return SDL_FALSE;
+		if ( !isMiddle(y, hitY, y+size) ) return SDL_FALSE;
 
 		// if we're here, there was a collision. Set up the result vector
-		result.m_x = m_x;
-		result.m_y = y;
+		result.m_x = x;
+		result.m_y = hitY;
 		return SDL_TRUE;
 	}
 	else
 	{
-		// we're a horizontal collision segment. 
-		double y = m_y - start.m_y; // distance from the start point to us.
-		double x = start.m_x + (y*dx)/dy; // this will be the x value of the movement line where it intersects our line.
+		// we're a horizontal collision segment. Same deal with moving along our line
+		if ( dy == 0 ) return SDL_FALSE;
+
+		T distY = y - start.m_y; // distance from the start point to us.
+		T hitX = start.m_x + (distY*dx)/dy; // this will be the x value of the movement line where it intersects our line.
 
 		// is that x value within our start and end y values?
-		if ( !isMiddle(m_x, x, m_x+m_size) ) return SDL_FALSE;
+		if ( !isMiddle(x, hitX, x+size) ) return SDL_FALSE;
 
 		// if we're here, there was a collision. Set up the result vector
-		result.m_x = x;
-		result.m_y = m_y;
+		result.m_x = hitX;
+		result.m_y = y;
 		return SDL_TRUE;
 	}
 }
 
-void CollideWall::push(Vector &pos)
+template <typename T>
+BasicCollideWall<T>::BasicCollideWall()
+{
+}
+
+template <typename T>
+BasicCollideWall<T>::~BasicCollideWall()
+{
+}
+
+template <typename T>
+void BasicCollideWall<T>::initVertical(int x, int y, int height, int push)
+{
+	m_bIsVertical = SDL_TRUE;
+	m_x = x;
+	m_y = y;
+	m_size = height;
+	setPush(push);
+}
+
+template <typename T>
+void BasicCollideWall<T>::initHorizontal(int x, int y, int length, int push)
+{
+	m_bIsVertical = SDL_FALSE;
+	m_x = x;
+	m_y = y;
+	m_size = length;
+	setPush(push);
+}
+
+template <typename T>
+void BasicCollideWall<T>::setPush(int push)
+{
+	m_push = getPushAmount(push);
+}
+
+template <typename T>
+SDL_bool BasicCollideWall<T>::checkCollision(VectorType &start, VectorType &end, VectorType &result)
+{
+	return checkWallCollision(m_bIsVertical, m_x, m_y, m_size, start, end, result);
+}
+
+template <typename T>
+void BasicCollideWall<T>::push(VectorType &pos)
 {
 	// apply the push to the appropriate 
 	// component of the vector.
@@ -163,18 +187,993 @@ void CollideWall::push(Vector &pos)
 	}
 }
 
-SDL_bool CollideWall::isMiddle(double a, double middle, double b)
+template <typename T>
+SDL_bool BasicCollideWall<T>::isMiddle(T a, T middle, T b)
+{
+	return ::isMiddle(a, middle, b);
+}
+
+// the only kinds we make. See Fixed in geometry.h
+template class BasicCollideWall<double>;
+template class BasicCollideWall<Fixed>;
+template SDL_bool checkWallCollision(SDL_bool bIsVertical, double x, double y, double size, Vector &start, Vector &end, Vector &result);
+template SDL_bool checkWallCollision(SDL_bool bIsVertical, Fixed x, Fixed y, Fixed size, FixedVector &start, FixedVector &end, FixedVector &result);
+
+/************************** WALL LIST *****************************/
+/************************** WALL LIST *****************************/
+/************************** WALL LIST *****************************/
+
+WallList::WallList()
+{
+	m_x = NULL;
+	m_y = NULL;
+	m_size = NULL;
+	m_push = NULL;
+	m_index = NULL;
+	m_count = 0;
+	m_capacity = 0;
+}
+
+WallList::~WallList()
+{
+	reserve(0);
+}
+
+void WallList::reserve(int capacity)
+{
+	delete [] m_x;
+	delete [] m_y;
+	delete [] m_size;
+	delete [] m_push;
+	delete [] m_index;
+	m_x = NULL;
+	m_y = NULL;
+	m_size = NULL;
+	m_push = NULL;
+	m_index = NULL;
+	m_count = 0;
+	m_capacity = capacity;
+
+	if ( capacity > 0 )
+	{
+		m_x = new float[capacity];
+		m_y = new float[capacity];
+		m_size = new float[capacity];
+		m_push = new float[capacity];
+		m_index = new Uint16[capacity];
+	}
+}
+
+void WallList::add(float x, float y, float size, float push, int index)
+{
+	// the callers size the list up front, so running out is a bug
+	if ( m_count >= m_capacity )
+	{
+		printf("WallList is full (%d walls)\n", m_capacity);
+		return;
+	}
+
+	m_x[m_count] = x;
+	m_y[m_count] = y;
+	m_size[m_count] = size;
+	m_push[m_count] = push;
+	m_index[m_count] = (Uint16)index;
+	m_count++;
+}
+
+/************************** BATCH TEST *****************************/
+/************************** BATCH TEST *****************************/
+/************************** BATCH TEST *****************************/
+
+// pick the vector unit we get to use. The scalar version at the bottom of
+// sweepWallBatch handles whatever is left over (or everything, if we have
+// neither).
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define COLLIDE_SSE 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON__)
+#define COLLIDE_NEON 1
+#include <arm_neon.h>
+#endif
+
+void sweepWallBatch(const float *across, const float *along, const float *size, const Uint16 *index, int count,
+					float acrossMin, float acrossMax, float alongMin, float alongMax, Uint32 *mask)
+{
+	// a wall can only be hit if it sits between the start and end of the movement,
+	// and its length overlaps the movement the other way. That's four compares per
+	// wall and no branches, so we can do four walls at a time.
+	int i = 0;
+
+#if COLLIDE_SSE
+	__m128 vAcrossMin = _mm_set1_ps(acrossMin);
+	__m128 vAcrossMax = _mm_set1_ps(acrossMax);
+	__m128 vAlongMin = _mm_set1_ps(alongMin);
+	__m128 vAlongMax = _mm_set1_ps(alongMax);
+	for ( ; i+4<=count ; i+=4 )
+	{
+		__m128 a = _mm_loadu_ps(across+i);
+		__m128 start = _mm_loadu_ps(along+i);
+		__m128 end = _mm_add_ps(start, _mm_loadu_ps(size+i));
+		__m128 inside = _mm_and_ps(_mm_cmpge_ps(a, vAcrossMin), _mm_cmple_ps(a, vAcrossMax));
+		__m128 overlap = _mm_and_ps(_mm_cmple_ps(start, vAlongMax), _mm_cmpge_ps(end, vAlongMin));
+		int hits = _mm_movemask_ps(_mm_and_ps(inside, overlap));
+		for ( int lane=0 ; hits!=0 ; lane++, hits >>= 1 )
+		{
+			if ( hits&1 )
+			{
+				int wall = index[i+lane];
+				mask[wall>>5] |= 1u << (wall&31);
+			}
+		}
+	}
+#elif COLLIDE_NEON
+	float32x4_t vAcrossMin = vdupq_n_f32(acrossMin);
+	float32x4_t vAcrossMax = vdupq_n_f32(acrossMax);
+	float32x4_t vAlongMin = vdupq_n_f32(alongMin);
+	float32x4_t vAlongMax = vdupq_n_f32(alongMax);
+	for ( ; i+4<=count ; i+=4 )
+	{
+		float32x4_t a = vld1q_f32(across+i);
+		float32x4_t start = vld1q_f32(along+i);
+		float32x4_t end = vaddq_f32(start, vld1q_f32(size+i));
+		uint32x4_t inside = vandq_u32(vcgeq_f32(a, vAcrossMin), vcleq_f32(a, vAcrossMax));
+		uint32x4_t overlap = vandq_u32(vcleq_f32(start, vAlongMax), vcgeq_f32(end, vAlongMin));
+		uint32x4_t hit = vandq_u32(inside, overlap);
+
+		// most of the time nothing in the group is hit. Check for that
+		// before pulling the lanes out one at a time.
+		uint32x2_t any = vorr_u32(vget_low_u32(hit), vget_high_u32(hit));
+		if ( (vget_lane_u32(any, 0) | vget_lane_u32(any, 1)) == 0 ) continue;
+
+		Uint32 lanes[4];
+		vst1q_u32(lanes, hit);
+		for ( int lane=0 ; lane<4 ; lane++ )
+		{
+			if ( lanes[lane] )
+			{
+				int wall = index[i+lane];
+				mask[wall>>5] |= 1u << (wall&31);
+			}
+		}
+	}
+#endif
+
+	for ( ; i<count ; i++ )
+	{
+		float end = along[i] + size[i];
+		Uint32 hit = (Uint32)((across[i] >= acrossMin) & (across[i] <= acrossMax) & (along[i] <= alongMax) & (end >= alongMin));
+		int wall = index[i];
+		mask[wall>>5] |= hit << (wall&31);
+	}
+}
+
+/************************** COLLIDE WALL SET *****************************/
+/************************** COLLIDE WALL SET *****************************/
+/************************** COLLIDE WALL SET *****************************/
+
+CollideWallSet::CollideWallSet()
+{
+	m_vertical.reserve(MAX_WALLS);
+	m_horizontal.reserve(MAX_WALLS);
+	clear();
+}
+
+void CollideWallSet::clear()
 {
-	// returns true if (a <= middle <= b) or if (b <= middle <= a)
+	m_vertical.m_count = 0;
+	m_horizontal.m_count = 0;
+	m_numWalls = 0;
+	memset(m_verticalMask, 0, sizeof(m_verticalMask));
+}
+
+int CollideWallSet::addVertical(int x, int y, int height, int push)
+{
+	if ( m_numWalls >= MAX_WALLS )
+	{
+		printf("Too many collide walls (%d)\n", m_numWalls);
+		return -1;
+	}
+
+	m_bIsVertical[m_numWalls] = SDL_TRUE;
+	m_slot[m_numWalls] = (Uint16)m_vertical.m_count;
+	m_verticalMask[m_numWalls>>5] |= 1u << (m_numWalls&31);
+	m_vertical.add((float)x, (float)y, (float)height, (float)getPushAmount(push), m_numWalls);
+	return m_numWalls++;
+}
 
-	if ( a <= middle )
+int CollideWallSet::addHorizontal(int x, int y, int length, int push)
+{
+	if ( m_numWalls >= MAX_WALLS )
 	{
-		if ( b >= middle ) return SDL_TRUE;
-		return SDL_FALSE;
+		printf("Too many collide walls (%d)\n", m_numWalls);
+		return -1;
 	}
 
-	// a must be > middle )
-	if ( b <= middle ) return SDL_TRUE;
-	return SDL_FALSE;
+	m_bIsVertical[m_numWalls] = SDL_FALSE;
+	m_slot[m_numWalls] = (Uint16)m_horizontal.m_count;
+	m_horizontal.add((float)x, (float)y, (float)length, (float)getPushAmount(push), m_numWalls);
+	return m_numWalls++;
+}
+
+SDL_bool CollideWallSet::isVertical(int wall)
+{
+	return m_bIsVertical[wall];
 }
 
+SDL_bool CollideWallSet::checkCollision(int wall, Vector &start, Vector &end, Vector &result)
+{
+	int slot = m_slot[wall];
+	if ( m_bIsVertical[wall] )
+	{
+		return VerticalWall::check(m_vertical.m_x[slot], m_vertical.m_y[slot], m_vertical.m_size[slot], start, end, result);
+	}
+	return HorizontalWall::check(m_horizontal.m_y[slot], m_horizontal.m_x[slot], m_horizontal.m_size[slot], start, end, result);
+}
+
+void CollideWallSet::push(int wall, Vector &pos)
+{
+	int slot = m_slot[wall];
+	if ( m_bIsVertical[wall] )
+	{
+		pos.m_x += m_vertical.m_push[slot];
+	}
+	else
+	{
+		pos.m_y += m_horizontal.m_push[slot];
+	}
+}
+
+// runs the collision test on the walls in one word of the candidates mask,
+// when they're all the same kind. across and along are the wall list's
+// arrays, put in across/along order for this kind of wall. See 
+// CollideWallSet::sweep
+template <int AXIS>
+static void sweepWord(const float *across, const float *along, const float *size, const Uint16 *slot, 
+					  Uint32 bits, int first, Vector &start, Vector &wantPos, int &collidedWith)
+{
+	// walk the bits from the bottom up, which is the order
+	// the walls were added in
+	Vector postCollision;
+	for ( int i=first ; bits!=0 ; i++, bits >>= 1 )
+	{
+		if ( (bits&1) == 0 ) continue;
+
+		int s = slot[i];
+		if ( AxisWall<AXIS>::check(across[s], along[s], size[s], start, wantPos, postCollision) )
+		{
+			wantPos.set(postCollision);
+			collidedWith = i;
+		}
+	}
+}
+
+int CollideWallSet::sweep(Vector &start, Vector &end, Uint32 *candidates, Vector &result)
+{
+	// We may hit multiple walls in a single movement. We want to stop at whichever
+	// one we hit first. Every hit cuts the movement short, so whichever one we hit
+	// first ends up being the last one that registers a collision. All the walls we
+	// hit that are before the winner will end up putting the stop point further than
+	// where we hit the winner. All of the walls after the winner will not register
+	// a collision at all, because the winner will have put the stop point before the
+	// movement intersected them.
+	// Which wall wins a tie (a movement right through a corner), and the last
+	// bits of where we stop, depend on the order, so the walls always go in
+	// the order they were added. Most words of the mask turn out to be all
+	// one kind of wall, and those run through a loop that never has to ask 
+	// which kind it has. The rest ask for each wall.
+	// only the words that have walls in them. Now that the blocks are
+	// their own thing, a level often has only a handful of walls.
+	int numWords = (m_numWalls + 31) >> 5;
+
+	Vector wantPos;
+	wantPos.set(end);
+	int collidedWith = -1;
+	Vector postCollision;
+	for ( int word=0 ; word<numWords ; word++ )
+	{
+		Uint32 bits = candidates[word];
+		if ( bits == 0 ) continue;
+
+		Uint32 vertical = bits & m_verticalMask[word];
+		if ( vertical == bits )
+		{
+			sweepWord<WALL_VERTICAL>(m_vertical.m_x, m_vertical.m_y, m_vertical.m_size, m_slot, bits, word*32, start, wantPos, collidedWith);
+			continue;
+		}
+		if ( vertical == 0 )
+		{
+			sweepWord<WALL_HORIZONTAL>(m_horizontal.m_y, m_horizontal.m_x, m_horizontal.m_size, m_slot, bits, word*32, start, wantPos, collidedWith);
+			continue;
+		}
+
+		// a mix
+		for ( int i=word*32 ; bits!=0 ; i++, bits >>= 1, vertical >>= 1 )
+		{
+			if ( (bits&1) == 0 ) continue;
+
+			int s = m_slot[i];
+			SDL_bool bHit;
+			if ( vertical&1 )
+			{
+				bHit = VerticalWall::check(m_vertical.m_x[s], m_vertical.m_y[s], m_vertical.m_size[s], start, wantPos, postCollision);
+			}
+			else
+			{
+				bHit = HorizontalWall::check(m_horizontal.m_y[s], m_horizontal.m_x[s], m_horizontal.m_size[s], start, wantPos, postCollision);
+			}
+			if ( bHit )
+			{
+				wantPos.set(postCollision);
+				collidedWith = i;
+			}
+		}
+	}
+
+	result.set(wantPos);
+	return collidedWith;
+}
+
+/************************** COLLIDE GRID *****************************/
+/************************** COLLIDE GRID *****************************/
+/************************** COLLIDE GRID *****************************/
+
+CollideGrid::CollideGrid()
+{
+	m_originX = 0;
+	m_originY = 0;
+	m_numCols = 0;
+	m_numRows = 0;
+	m_cellVerticalStart = NULL;
+	m_cellHorizontalStart = NULL;
+}
+
+CollideGrid::~CollideGrid()
+{
+	delete [] m_cellVerticalStart;
+	delete [] m_cellHorizontalStart;
+}
+
+void CollideGrid::build(CollideWallSet &walls, int x, int y, int width, int height)
+{
+	// size the grid to cover the playfield. We round up so a partial
+	// cell at the right or bottom edge still gets its own cell.
+	m_originX = x;
+	m_originY = y;
+	m_numCols = (width + CELL_SIZE - 1)/CELL_SIZE;
+	m_numRows = (height + CELL_SIZE - 1)/CELL_SIZE;
+	if ( m_numCols < 1 ) m_numCols = 1;
+	if ( m_numRows < 1 ) m_numRows = 1;
+
+	delete [] m_cellVerticalStart;
+	delete [] m_cellHorizontalStart;
+	m_cellVerticalStart = new int[m_numCols*m_numRows + 1];
+	m_cellHorizontalStart = new int[m_numCols*m_numRows + 1];
+
+	buildList(walls.m_vertical, SDL_TRUE, m_cellVertical, m_cellVerticalStart);
+	buildList(walls.m_horizontal, SDL_FALSE, m_cellHorizontal, m_cellHorizontalStart);
+}
+
+void CollideGrid::buildList(WallList &walls, SDL_bool bIsVertical, WallList &outCellWalls, int *outCellStart)
+{
+	int numCells = m_numCols*m_numRows;
+
+	// first pass: count how many walls land in each cell, so we know
+	// where each cell's walls start.
+	for ( int c=0 ; c<=numCells ; c++ )
+	{
+		outCellStart[c] = 0;
+	}
+	int total = 0;
+	for ( int pass=0 ; pass<2 ; pass++ )
+	{
+		for ( int i=0 ; i<walls.m_count ; i++ )
+		{
+			double x2 = walls.m_x[i];
+			double y2 = walls.m_y[i];
+			if ( bIsVertical )
+			{
+				y2 += walls.m_size[i];
+			}
+			else
+			{
+				x2 += walls.m_size[i];
+			}
+
+			int col1, row1, col2, row2;
+			getCellRange(walls.m_x[i], walls.m_y[i], x2, y2, col1, row1, col2, row2);
+			for ( int row=row1 ; row<=row2 ; row++ )
+			{
+				for ( int col=col1 ; col<=col2 ; col++ )
+				{
+					int cell = row*m_numCols + col;
+					if ( pass == 0 )
+					{
+						outCellStart[cell+1]++;
+						total++;
+					}
+					else
+					{
+						// second pass: copy the wall in to the next free spot of the cell.
+						// outCellStart[cell] is used as that cursor, and gets put back below.
+						int slot = outCellStart[cell]++;
+						outCellWalls.m_x[slot] = walls.m_x[i];
+						outCellWalls.m_y[slot] = walls.m_y[i];
+						outCellWalls.m_size[slot] = walls.m_size[i];
+						outCellWalls.m_push[slot] = walls.m_push[i];
+						outCellWalls.m_index[slot] = walls.m_index[i];
+					}
+				}
+			}
+		}
+
+		if ( pass == 0 )
+		{
+			// turn the counts in to start positions
+			for ( int c=0 ; c<numCells ; c++ )
+			{
+				outCellStart[c+1] += outCellStart[c];
+			}
+			outCellWalls.reserve(total);
+			outCellWalls.m_count = total;
+		}
+	}
+
+	// the cursors ran each cell's start up to the next cell's start. Shift them back.
+	for ( int c=numCells ; c>0 ; c-- )
+	{
+		outCellStart[c] = outCellStart[c-1];
+	}
+	outCellStart[0] = 0;
+}
+
+int CollideGrid::query(double x1, double y1, double x2, double y2, Uint32 *outMask)
+{
+	memset(outMask, 0, MASK_WORDS*sizeof(Uint32));
+
+	// the box the movement covers, padded by a pixel. The padding soaks
+	// up float rounding, and the intersection point being calculated
+	// a hair outside of the movement's own box.
+	if ( x1 > x2 ) { double t = x1; x1 = x2; x2 = t; }
+	if ( y1 > y2 ) { double t = y1; y1 = y2; y2 = t; }
+	float minX = (float)(x1 - 1.0);
+	float maxX = (float)(x2 + 1.0);
+	float minY = (float)(y1 - 1.0);
+	float maxY = (float)(y2 + 1.0);
+
+	int col1, row1, col2, row2;
+	getCellRange(x1, y1, x2, y2, col1, row1, col2, row2);
+
+	int tested = 0;
+	for ( int row=row1 ; row<=row2 ; row++ )
+	{
+		for ( int col=col1 ; col<=col2 ; col++ )
+		{
+			int cell = row*m_numCols + col;
+
+			// verticals sit at an x and run along y
+			int start = m_cellVerticalStart[cell];
+			int count = m_cellVerticalStart[cell+1] - start;
+			sweepWallBatch(m_cellVertical.m_x+start, m_cellVertical.m_y+start, m_cellVertical.m_size+start,
+							m_cellVertical.m_index+start, count, minX, maxX, minY, maxY, outMask);
+			tested += count;
+
+			// horizontals are the other way around
+			start = m_cellHorizontalStart[cell];
+			count = m_cellHorizontalStart[cell+1] - start;
+			sweepWallBatch(m_cellHorizontal.m_y+start, m_cellHorizontal.m_x+start, m_cellHorizontal.m_size+start,
+							m_cellHorizontal.m_index+start, count, minY, maxY, minX, maxX, outMask);
+			tested += count;
+		}
+	}
+
+	return tested;
+}
+
+void CollideGrid::getCellRange(double x1, double y1, double x2, double y2, int &outCol1, int &outRow1, int &outCol2, int &outRow2)
+{
+	// pad the box by a pixel, same as query does, so a wall sitting
+	// right on a cell boundary is never missed.
+	if ( x1 > x2 ) { double t = x1; x1 = x2; x2 = t; }
+	if ( y1 > y2 ) { double t = y1; y1 = y2; y2 = t; }
+	outCol1 = getCell(x1 - 1.0 - m_originX, m_numCols);
+	outCol2 = getCell(x2 + 1.0 - m_originX, m_numCols);
+	outRow1 = getCell(y1 - 1.0 - m_originY, m_numRows);
+	outRow2 = getCell(y2 + 1.0 - m_originY, m_numRows);
+}
+
+int CollideGrid::getCell(double pos, int numCells)
+{
+	// pos is measured from the grid's origin. Anything off the
+	// playfield is clamped in to the edge cells
+	if ( pos < 0.0 ) return 0;
+	if ( pos >= (double)(numCells*CELL_SIZE) ) return numCells-1;
+	return (int)(pos/CELL_SIZE);
+}
+
+/************************** COLLIDE BLOCKS *****************************/
+/************************** COLLIDE BLOCKS *****************************/
+/************************** COLLIDE BLOCKS *****************************/
+
+// a quarter pixel, same as the walls (see getPushAmount)
+static const double BLOCK_PUSH = 0.25;
+
+CollideBlockSet::CollideBlockSet()
+{
+	m_numBlocks = 0;
+	m_radius = 0.0;
+	m_originX = 0;
+	m_originY = 0;
+	m_numCols = 0;
+	m_numRows = 0;
+	m_cellStart = NULL;
+	m_cellBlocks = NULL;
+}
+
+CollideBlockSet::~CollideBlockSet()
+{
+	delete [] m_cellStart;
+	delete [] m_cellBlocks;
+}
+
+int CollideBlockSet::add(int x, int y, int width, int height)
+{
+	if ( m_numBlocks >= MAX_BLOCKS )
+	{
+		printf("Too many collide blocks (%d)\n", m_numBlocks);
+		return -1;
+	}
+
+	CollideBlock &block = m_blocks[m_numBlocks];
+	block.m_left = x;
+	block.m_top = y;
+	block.m_right = x + width - 1;
+	block.m_bottom = y + height - 1;
+	return m_numBlocks++;
+}
+
+void CollideBlockSet::clear()
+{
+	m_numBlocks = 0;
+}
+
+int CollideBlockSet::getCount()
+{
+	return m_numBlocks;
+}
+
+void CollideBlockSet::build(int x, int y, int width, int height, double radius)
+{
+	// built just like TriggerSet::build, with each block grown by the radius
+	m_radius = radius;
+	m_originX = x;
+	m_originY = y;
+	m_numCols = (width + CELL_SIZE - 1)/CELL_SIZE;
+	m_numRows = (height + CELL_SIZE - 1)/CELL_SIZE;
+	if ( m_numCols < 1 ) m_numCols = 1;
+	if ( m_numRows < 1 ) m_numRows = 1;
+	int numCells = m_numCols*m_numRows;
+
+	delete [] m_cellStart;
+	m_cellStart = new int[numCells + 1];
+	for ( int c=0 ; c<=numCells ; c++ )
+	{
+		m_cellStart[c] = 0;
+	}
+
+	// count the blocks in each cell
+	int total = 0;
+	for ( int i=0 ; i<m_numBlocks ; i++ )
+	{
+		CollideBlock &block = m_blocks[i];
+		int col1, row1, col2, row2;
+		getCellRange(block.m_left - radius, block.m_top - radius, block.m_right + radius, block.m_bottom + radius, col1, row1, col2, row2);
+		for ( int row=row1 ; row<=row2 ; row++ )
+		{
+			for ( int col=col1 ; col<=col2 ; col++ )
+			{
+				m_cellStart[row*m_numCols + col + 1]++;
+				total++;
+			}
+		}
+	}
+	for ( int c=0 ; c<numCells ; c++ )
+	{
+		m_cellStart[c+1] += m_cellStart[c];
+	}
+
+	// then drop them in, using m_cellStart as the cursor and putting it back after
+	delete [] m_cellBlocks;
+	m_cellBlocks = new Uint16[total > 0 ? total : 1];
+	for ( int i=0 ; i<m_numBlocks ; i++ )
+	{
+		CollideBlock &block = m_blocks[i];
+		int col1, row1, col2, row2;
+		getCellRange(block.m_left - radius, block.m_top - radius, block.m_right + radius, block.m_bottom + radius, col1, row1, col2, row2);
+		for ( int row=row1 ; row<=row2 ; row++ )
+		{
+			for ( int col=col1 ; col<=col2 ; col++ )
+			{
+				m_cellBlocks[m_cellStart[row*m_numCols + col]++] = (Uint16)i;
+			}
+		}
+	}
+	for ( int c=numCells ; c>0 ; c-- )
+	{
+		m_cellStart[c] = m_cellStart[c-1];
+	}
+	m_cellStart[0] = 0;
+}
+
+int CollideBlockSet::query(double x1, double y1, double x2, double y2, Uint32 *outMask)
+{
+	// the mask has room for MAX_BLOCKS, but a level usually has a lot
+	// fewer than that
+	memset(outMask, 0, ((m_numBlocks + 31) >> 5)*sizeof(Uint32));
+	if ( m_cellStart == NULL ) return 0;
+
+	int col1, row1, col2, row2;
+	getCellRange(x1, y1, x2, y2, col1, row1, col2, row2);
+
+	// a block in more than one of the cells only gets counted the once
+	int found = 0;
+	for ( int row=row1 ; row<=row2 ; row++ )
+	{
+		for ( int col=col1 ; col<=col2 ; col++ )
+		{
+			int cell = row*m_numCols + col;
+			for ( int i=m_cellStart[cell] ; i<m_cellStart[cell+1] ; i++ )
+			{
+				int block = m_cellBlocks[i];
+				Uint32 bit = 1u << (block & 31);
+				if ( outMask[block >> 5] & bit ) continue;
+				outMask[block >> 5] |= bit;
+				found++;
+			}
+		}
+	}
+	return found;
+}
+
+int CollideBlockSet::sweep(const Vector &start, const Vector &end, const Uint32 *candidates, double &outTime, Vector &outNormal)
+{
+	// unlike the walls, each block tells us exactly how far along the 
+	// movement it got hit, so we just keep the earliest. If two are hit at
+	// the same time, the one added first wins.
+	int hitBlock = -1;
+	outTime = 1.0;
+	outNormal.setXY(0, 0);
+	int numWords = (m_numBlocks + 31) >> 5;
+	for ( int word=0 ; word<numWords ; word++ )
+	{
+		Uint32 bits = candidates[word];
+		for ( int i=word*32 ; bits!=0 ; i++, bits >>= 1 )
+		{
+			if ( (bits&1) == 0 ) continue;
+
+			double time;
+			Vector normal;
+			if ( checkCollision(i, start, end, time, normal) && (hitBlock < 0 || time < outTime) )
+			{
+				hitBlock = i;
+				outTime = time;
+				outNormal.set(normal);
+			}
+		}
+	}
+	return hitBlock;
+}
+
+SDL_bool CollideBlockSet::checkCollision(int block, const Vector &start, const Vector &end, double &outTime, Vector &outNormal)
+{
+	// The ball's center hits the block when it gets within the radius of it.
+	// That shape is the block's rect grown by the radius on every side, with
+	// quarter circles for corners. We find where the movement goes in to the
+	// grown rect (the corners still square), and then look at where that is.
+	// If it's along one of the sides, that's the hit. If it's in one of the 
+	// corners, the movement might still miss the rounded part, so we find 
+	// where it hits that corner's circle instead.
+	CollideBlock &b = m_blocks[block];
+	double r = m_radius;
+	double delta[2] = { end.m_x - start.m_x, end.m_y - start.m_y };
+	double from[2] = { start.m_x, start.m_y };
+	double rectMin[2] = { b.m_left, b.m_top };
+	double rectMax[2] = { b.m_right, b.m_bottom };
+
+	// if the start is already in it (a ball pushed in by another ball, say), 
+	// we stop the ball right where it is, but only if it's heading further
+	// in. Heading out, we let it go.
+	double nearX = from[0] < rectMin[0] ? rectMin[0] : (from[0] > rectMax[0] ? rectMax[0] : from[0]);
+	double nearY = from[1] < rectMin[1] ? rectMin[1] : (from[1] > rectMax[1] ? rectMax[1] : from[1]);
+	double awayX = from[0] - nearX;
+	double awayY = from[1] - nearY;
+	double distSq = awayX*awayX + awayY*awayY;
+	if ( distSq < r*r )
+	{
+		if ( distSq > 0.0 )
+		{
+			double dist = sqrt(distSq);
+			outNormal.setXY(awayX/dist, awayY/dist);
+		}
+		else
+		{
+			// the center is right inside the rect. Out through the closest side.
+			double toLeft = from[0] - rectMin[0];
+			double toRight = rectMax[0] - from[0];
+			double toTop = from[1] - rectMin[1];
+			double toBottom = rectMax[1] - from[1];
+			double closest = toLeft;
+			outNormal.setXY(-1, 0);
+			if ( toRight < closest ) { closest = toRight; outNormal.setXY(1, 0); }
+			if ( toTop < closest ) { closest = toTop; outNormal.setXY(0, -1); }
+			if ( toBottom < closest ) { outNormal.setXY(0, 1); }
+		}
+		if ( delta[0]*outNormal.m_x + delta[1]*outNormal.m_y >= 0.0 ) return SDL_FALSE;
+		outTime = 0.0;
+		return SDL_TRUE;
+	}
+
+	// clip the movement to the grown rect, one direction at a time, 
+	// remembering which direction it went in last (that's the side it 
+	// went in through)
+	double tEnter = -1.0;
+	double tExit = 2.0;
+	int enterAxis = -1;
+	for ( int axis=0 ; axis<2 ; axis++ )
+	{
+		double lo = rectMin[axis] - r;
+		double hi = rectMax[axis] + r;
+		if ( delta[axis] == 0.0 )
+		{
+			if ( from[axis] < lo || from[axis] > hi ) return SDL_FALSE;
+			continue;
+		}
+
+		double t1 = (lo - from[axis])/delta[axis];
+		double t2 = (hi - from[axis])/delta[axis];
+		if ( t1 > t2 ) { double t = t1; t1 = t2; t2 = t; }
+		if ( t1 > tEnter ) { tEnter = t1; enterAxis = axis; }
+		if ( t2 < tExit ) tExit = t2;
+	}
+	if ( tEnter > tExit || tEnter > 1.0 || tExit < 0.0 ) return SDL_FALSE;
+
+	// where it goes in. If the start is already inside the grown rect, it
+	// has to be in one of the corners (otherwise it'd be in the block,
+	// which we dealt with above), so we start from there.
+	if ( tEnter < 0.0 ) tEnter = 0.0;
+	double hitX = from[0] + delta[0]*tEnter;
+	double hitY = from[1] + delta[1]*tEnter;
+
+	// in a corner, it's outside the rect both ways
+	SDL_bool bCornerX = (hitX < rectMin[0] || hitX > rectMax[0]) ? SDL_TRUE : SDL_FALSE;
+	SDL_bool bCornerY = (hitY < rectMin[1] || hitY > rectMax[1]) ? SDL_TRUE : SDL_FALSE;
+	if ( !bCornerX || !bCornerY )
+	{
+		// a flat side. It faces back the way we came, on the side we went in.
+		// (enterAxis is only unset if we aren't moving at all)
+		if ( enterAxis < 0 ) return SDL_FALSE;
+		outNormal.setXY(0, 0);
+		if ( enterAxis == 0 ) outNormal.m_x = delta[0] > 0.0 ? -1.0 : 1.0;
+		else outNormal.m_y = delta[1] > 0.0 ? -1.0 : 1.0;
+		outTime = tEnter;
+		return SDL_TRUE;
+	}
+
+	// a corner. Solve for when the center is exactly the radius away from
+	// the corner: |from + delta*t - corner|^2 = r^2, which is a quadratic
+	// in t. The smaller root is when it gets there. Passing through the
+	// corner square without touching the circle is a miss; it can't get to
+	// either of the sides from there without going through the circle.
+	double cornerX = hitX < rectMin[0] ? rectMin[0] : rectMax[0];
+	double cornerY = hitY < rectMin[1] ? rectMin[1] : rectMax[1];
+	double mx = from[0] - cornerX;
+	double my = from[1] - cornerY;
+	double a = delta[0]*delta[0] + delta[1]*delta[1];
+	double halfB = mx*delta[0] + my*delta[1];
+	double c = mx*mx + my*my - r*r;
+	double discriminant = halfB*halfB - a*c;
+
+	// heading away from the corner (halfB >= 0), or missing it altogether
+	if ( halfB >= 0.0 || discriminant <= 0.0 ) return SDL_FALSE;
+	double t = (-halfB - sqrt(discriminant))/a;
+	if ( t > 1.0 ) return SDL_FALSE;
+	if ( t < 0.0 ) t = 0.0;
+
+	outNormal.setXY((mx + delta[0]*t)/r, (my + delta[1]*t)/r);
+	outTime = t;
+	return SDL_TRUE;
+}
+
+void CollideBlockSet::push(const Vector &normal, Vector &pos)
+{
+	pos.m_x += normal.m_x*BLOCK_PUSH;
+	pos.m_y += normal.m_y*BLOCK_PUSH;
+}
+
+void CollideBlockSet::bounce(Vector &vel, const Vector &normal, double minVelocity)
+{
+	// the same bounce as the walls (see AxisWall::bounce), but along the 
+	// normal: the speed in to the block reverses, keeping only a quarter,
+	// or stops if that's less than minVelocity. The speed along the 
+	// surface is unaffected. On a flat side this is exactly the wall bounce.
+	double in = vel.m_x*normal.m_x + vel.m_y*normal.m_y;
+	if ( in >= 0.0 ) return; // already moving away
+	double out = -0.25*in;
+	if ( out*out < minVelocity*minVelocity )
+	{
+		out = 0.0;
+	}
+	vel.m_x += normal.m_x*(out - in);
+	vel.m_y += normal.m_y*(out - in);
+}
+
+void CollideBlockSet::getCellRange(double x1, double y1, double x2, double y2, int &outCol1, int &outRow1, int &outCol2, int &outRow2)
+{
+	// padded by a pixel, same as CollideGrid, so nothing sitting right on a
+	// cell boundary is ever missed
+	if ( x1 > x2 ) { double t = x1; x1 = x2; x2 = t; }
+	if ( y1 > y2 ) { double t = y1; y1 = y2; y2 = t; }
+	outCol1 = getCell(x1 - 1.0 - m_originX, m_numCols);
+	outCol2 = getCell(x2 + 1.0 - m_originX, m_numCols);
+	outRow1 = getCell(y1 - 1.0 - m_originY, m_numRows);
+	outRow2 = getCell(y2 + 1.0 - m_originY, m_numRows);
+}
+
+int CollideBlockSet::getCell(double pos, int numCells)
+{
+	// pos is measured from the grid's origin. Anything off the
+	// playfield is clamped in to the edge cells
+	if ( pos < 0.0 ) return 0;
+	if ( pos >= (double)(numCells*CELL_SIZE) ) return numCells-1;
+	return (int)(pos/CELL_SIZE);
+}
+
+/************************** BALL HASH *****************************/
+/************************** BALL HASH *****************************/
+/************************** BALL HASH *****************************/
+
+BallHash::BallHash()
+{
+	m_numBalls = 0;
+	m_capacity = 0;
+	m_cellSize = 1.0;
+	m_x = NULL;
+	m_y = NULL;
+	m_cellX = NULL;
+	m_cellY = NULL;
+	m_numBuckets = 0;
+	m_bucketStart = NULL;
+	m_sorted = NULL;
+}
+
+BallHash::~BallHash()
+{
+	delete [] m_x;
+	delete [] m_y;
+	delete [] m_cellX;
+	delete [] m_cellY;
+	delete [] m_bucketStart;
+	delete [] m_sorted;
+}
+
+void BallHash::begin(int numBalls, double cellSize)
+{
+	// only reallocate when the number of balls goes up
+	if ( numBalls > m_capacity )
+	{
+		delete [] m_x;
+		delete [] m_y;
+		delete [] m_cellX;
+		delete [] m_cellY;
+		delete [] m_bucketStart;
+		delete [] m_sorted;
+
+		m_capacity = numBalls;
+		m_numBuckets = 1;
+		while ( m_numBuckets < numBalls*2 )
+		{
+			m_numBuckets <<= 1;
+		}
+
+		m_x = new double[m_capacity];
+		m_y = new double[m_capacity];
+		m_cellX = new int[m_capacity];
+		m_cellY = new int[m_capacity];
+		m_sorted = new int[m_capacity];
+		m_bucketStart = new int[m_numBuckets+1];
+	}
+
+	m_numBalls = numBalls;
+	m_cellSize = cellSize;
+}
+
+void BallHash::add(int index, double x, double y)
+{
+	m_x[index] = x;
+	m_y[index] = y;
+	m_cellX[index] = getCell(x);
+	m_cellY[index] = getCell(y);
+}
+
+void BallHash::end()
+{
+	// sort the balls by bucket. Count up each bucket, turn the 
+	// counts in to start positions, then drop each ball in to place.
+	for ( int b=0 ; b<=m_numBuckets ; b++ )
+	{
+		m_bucketStart[b] = 0;
+	}
+	for ( int i=0 ; i<m_numBalls ; i++ )
+	{
+		m_bucketStart[getBucket(m_cellX[i], m_cellY[i])+1]++;
+	}
+	for ( int b=0 ; b<m_numBuckets ; b++ )
+	{
+		m_bucketStart[b+1] += m_bucketStart[b];
+	}
+
+	// m_bucketStart[b] gets used as the fill cursor for bucket b, 
+	// which leaves it pointing at the start of bucket b+1. 
+	for ( int i=0 ; i<m_numBalls ; i++ )
+	{
+		m_sorted[m_bucketStart[getBucket(m_cellX[i], m_cellY[i])]++] = i;
+	}
+	for ( int b=m_numBuckets ; b>0 ; b-- )
+	{
+		m_bucketStart[b] = m_bucketStart[b-1];
+	}
+	m_bucketStart[0] = 0;
+}
+
+int BallHash::findPairs(double minDist, int *outPairs, int maxPairs)
+{
+	double minDistSq = minDist*minDist;
+	int numPairs = 0;
+
+	for ( int i=0 ; i<m_numBalls ; i++ )
+	{
+		for ( int dy=-1 ; dy<=1 ; dy++ )
+		{
+			for ( int dx=-1 ; dx<=1 ; dx++ )
+			{
+				int cellX = m_cellX[i] + dx;
+				int cellY = m_cellY[i] + dy;
+				int bucket = getBucket(cellX, cellY);
+				for ( int k=m_bucketStart[bucket] ; k<m_bucketStart[bucket+1] ; k++ )
+				{
+					// only take each pair once, from the lower numbered ball.
+					// Different cells can land in the same bucket, so make sure
+					// the other ball really is in the cell we're looking at.
+					// Otherwise a pair could turn up twice.
+					int j = m_sorted[k];
+					if ( j <= i ) continue;
+					if ( m_cellX[j] != cellX || m_cellY[j] != cellY ) continue;
+
+					double distX = m_x[j] - m_x[i];
+					double distY = m_y[j] - m_y[i];
+					if ( distX*distX + distY*distY >= minDistSq ) continue;
+
+					if ( numPairs >= maxPairs ) return numPairs;
+					outPairs[numPairs*2] = i;
+					outPairs[numPairs*2+1] = j;
+					numPairs++;
+				}
+			}
+		}
+	}
+
+	return numPairs;
+}
+
+int BallHash::getCell(double pos)
+{
+	// round toward negative infinity, so the cells either side
+	// of 0 don't end up being the same cell
+	return (int)floor(pos/m_cellSize);
+}
+
+int BallHash::getBucket(int cellX, int cellY)
+{
+	// the usual pair of big primes for hashing grid cells
+	Uint32 hash = ((Uint32)cellX*73856093u) ^ ((Uint32)cellY*19349663u);
+	return (int)(hash & (Uint32)(m_numBuckets-1));
+}
@@ -9,11 +9,16 @@
 // you how to do things, and not a high-end game made to impress and astound,
 // we'll just have purely vertical and horizontal collision walls because it makes
 // things a lot easier. 
-class CollideWall
+// CollideWall is the regular one, in doubles. FixedCollideWall is the same
+// thing in fixed point (see Fixed in geometry.h). 
+template <typename T>
+class BasicCollideWall
 {
 public:
-	CollideWall();
-	~CollideWall();
+	typedef BasicVector<T> VectorType;
+
+	BasicCollideWall();
+	~BasicCollideWall();
 
 	// for these initters, x and y are the start point. Then
 	// length is either the vertical or horizontal size (depending on if
@@ -28,23 +33,418 @@ public:
 	void initVertical(int x, int y, int height, int push);
 	void initHorizontal(int x, int y, int length, int push);
 
-	SDL_bool checkCollision(Vector &start, Vector &end, Vector &result);
-	SDL_bool isMiddle(double a, double middle, double b); // returns trus if a<=middle<=b or b<=middle<=a
-	void push(Vector &pos); // apply the push value to the postion
+	SDL_bool checkCollision(VectorType &start, VectorType &end, VectorType &result);
+	SDL_bool isMiddle(T a, T middle, T b); // returns trus if a<=middle<=b or b<=middle<=a
+	void push(VectorType &pos); // apply the push value to the postion
 
 	// itnernals
 	void setPush(int push); 
 
-	// data. stored as doubles to minimize needless casting
+	// data. stored as T to minimize needless casting
 	SDL_bool m_bIsVertical;
-	double m_x;
-	double m_y;
-	double m_size; // width or length, depending on the orientation
-	double m_push;
+	T m_x;
+	T m_y;
+	T m_size; // width or length, depending on the orientation
+	T m_push;
+};
+
+typedef BasicCollideWall<double> CollideWall;
+typedef BasicCollideWall<Fixed> FixedCollideWall;
+
+// the collision math for a single wall, shared by CollideWall and
+// CollideWallSet so both give exactly the same answers. See 
+// CollideWall::checkCollision for how it works.
+// Made for doubles and for Fixed.
+template <typename T>
+SDL_bool checkWallCollision(SDL_bool bIsVertical, T x, T y, T size, BasicVector<T> &start, BasicVector<T> &end, BasicVector<T> &result);
+
+// returns true if a<=middle<=b or b<=middle<=a
+template <typename T>
+inline SDL_bool isMiddle(T a, T middle, T b)
+{
+	if ( a <= middle ) return b >= middle ? SDL_TRUE : SDL_FALSE;
+	return b <= middle ? SDL_TRUE : SDL_FALSE;
+}
+
+// the two ways a wall can run, for AxisWall below
+enum
+{
+	WALL_VERTICAL = 0,
+	WALL_HORIZONTAL = 1
+};
+
+// picks the parts of a Vector that matter to a wall running one way or the
+// other. across is the direction the wall stops things in (x for a vertical
+// wall), and along is the direction it runs (y for a vertical wall).
+template <int AXIS> struct WallAxis;
+
+template <> struct WallAxis<WALL_VERTICAL>
+{
+	template <typename T> static T &across(BasicVector<T> &v) { return v.m_x; }
+	template <typename T> static T &along(BasicVector<T> &v) { return v.m_y; }
+};
+
+template <> struct WallAxis<WALL_HORIZONTAL>
+{
+	template <typename T> static T &across(BasicVector<T> &v) { return v.m_y; }
+	template <typename T> static T &along(BasicVector<T> &v) { return v.m_x; }
 };
 
+// CollideWall works out which way it runs every time it's asked to do 
+// anything. An AxisWall knows which way it runs when it's compiled, so all
+// the "is it vertical?" questions go away, and a loop over a list of one kind
+// of wall has no branches on it at all. The math is exactly the same as 
+// CollideWall's (it's the same code, with x and y swapped out for across and 
+// along), so both give exactly the same answers. Like CollideWall, it can
+// be made with Fixed instead of double.
+template <int AXIS, typename T = double>
+class AxisWall
+{
+public:
+	typedef WallAxis<AXIS> Axis;
+	typedef BasicVector<T> VectorType;
+
+	// same parameters as CollideWall::initVertical (for a VerticalWall)
+	// and CollideWall::initHorizontal (for a HorizontalWall)
+	void init(int x, int y, int length, int push)
+	{
+		VectorType start;
+		start.setXY(x, y);
+		m_across = Axis::across(start);
+		m_along = Axis::along(start);
+		m_size = length;
+		m_push = T(push > 0 ? 0.25 : (push < 0 ? -0.25 : 0.0));
+	}
+
+	SDL_bool checkCollision(VectorType &start, VectorType &end, VectorType &result)
+	{
+		return check(m_across, m_along, m_size, start, end, result);
+	}
+
+	void push(VectorType &pos)
+	{
+		Axis::across(pos) += m_push;
+	}
+
+	// the collision test, for a wall that isn't stored as an AxisWall.
+	// See CollideWall::checkCollision for how it works.
+	static SDL_bool check(T across, T along, T size, VectorType &start, VectorType &end, VectorType &result)
+	{
+		result.set(end);
+
+		// do the start and the end sit on different sides of the wall?
+		if ( !isMiddle(Axis::across(start), across, Axis::across(end)) ) return SDL_FALSE;
+
+		// both before the start of the wall?
+		if ( (Axis::along(start)<along) && (Axis::along(end)<along) ) return SDL_FALSE;
+
+		// both past the end of it? (measured from the start of the movement,
+		// same as CollideWall always has)
+		T farAlong = Axis::along(start) + size;
+		if ( (Axis::along(start)>farAlong) && (Axis::along(end)>farAlong) ) return SDL_FALSE;
+
+		// where the movement crosses the wall's line
+		// a movement that runs right along the wall's line never crosses it.
+		// (in doubles, that'd be a 0/0 below that fails the last test anyway)
+		T dAcross = Axis::across(end) - Axis::across(start);
+		if ( dAcross == 0 ) return SDL_FALSE;
+		T dAlong = Axis::along(end) - Axis::along(start);
+		T distAcross = across - Axis::across(start);
+		T hitAlong = Axis::along(start) + (distAcross*dAlong)/dAcross;
+		if ( !isMiddle(along, hitAlong, along+size) ) return SDL_FALSE;
+
+		Axis::across(result) = across;
+		Axis::along(result) = hitAlong;
+		return SDL_TRUE;
+	}
+
+	// how much of a movement from start to end was used up getting to
+	// stop, where stop is the point the movement hit this kind of wall
+	static T getUsedRatio(VectorType &start, VectorType &end, VectorType &stop)
+	{
+		return (Axis::across(stop) - Axis::across(start))/(Axis::across(end) - Axis::across(start));
+	}
+
+	// bounces a velocity off this kind of wall. The velocity across the
+	// wall reverses, and only keeps a quarter of its speed. If that's less
+	// than minVelocity, it stops altogether. Along the wall it's unaffected.
+	static void bounce(VectorType &vel, T minVelocity)
+	{
+		T &v = Axis::across(vel);
+		v = -0.25 * v;
+		if ( (v * v) < (minVelocity*minVelocity) ) 
+		{
+			v = 0;
+		}
+	}
+
+	// data
+	T m_across;
+	T m_along;
+	T m_size;
+	T m_push;
+};
+
+typedef AxisWall<WALL_VERTICAL> VerticalWall;
+typedef AxisWall<WALL_HORIZONTAL> HorizontalWall;
+typedef AxisWall<WALL_VERTICAL, Fixed> FixedVerticalWall;
+typedef AxisWall<WALL_HORIZONTAL, Fixed> FixedHorizontalWall;
+
+// a list of walls that all run the same way, stored as parallel arrays
+// rather than as an array of objects. For a vertical wall, x is where 
+// the wall sits and y is where it starts. For a horizontal wall it's the
+// other way around. Floats are plenty, because walls are always placed
+// on whole pixels (and a float holds any int we'll ever use exactly).
+class WallList
+{
+public:
+	WallList();
+	~WallList();
+
+	void reserve(int capacity); // throws away the current contents
+	void add(float x, float y, float size, float push, int index);
+
+	// data
+	float *m_x;
+	float *m_y;
+	float *m_size;
+	float *m_push;
+	Uint16 *m_index; // where the wall sits in the order walls were added
+	int m_count;
+	int m_capacity;
+};
+
+// tests one movement against a whole list of walls at once. across is the
+// position of each wall across its length (x for verticals), along is where
+// it starts along its length (y for verticals). Every wall whose line could
+// be crossed by a movement inside the given bounds gets its bit set in mask.
+// This is a coarse test, not the real collision: it's allowed to report
+// walls the movement misses, but never to skip one it hits. Uses SSE on x86
+// and NEON on the Pre when the compiler has them turned on.
+void sweepWallBatch(const float *across, const float *along, const float *size, const Uint16 *index, int count, 
+					float acrossMin, float acrossMax, float alongMin, float alongMax, Uint32 *mask);
+
+// all the collide walls in a level. The walls are split up in to 
+// vertical and horizontal lists, and a bit for each wall says which list
+// it's in, so the code testing a run of one kind never has to ask which 
+// way a wall runs.
+class CollideWallSet
+{
+public:
+	// the most walls we can hold, and the number of 32 bit words
+	// needed for a mask with one bit per wall.
+	static const int MAX_WALLS = 1024;
+	static const int MASK_WORDS = MAX_WALLS/32;
+
+	CollideWallSet();
+
+	// same parameters as CollideWall::initVertical and CollideWall::initHorizontal.
+	// They return the index of the new wall, or -1 if we're full.
+	int addVertical(int x, int y, int height, int push);
+	int addHorizontal(int x, int y, int length, int push);
+	void clear();
 
+	SDL_bool isVertical(int wall);
+	SDL_bool checkCollision(int wall, Vector &start, Vector &end, Vector &result);
+	void push(int wall, Vector &pos); // apply the push value of the wall to the position
 
+	// runs the full collision test on every wall in the candidates mask, in
+	// the order the walls were added, exactly as GameLogic always has: each 
+	// hit cuts the movement short for the walls after it. result gets the 
+	// final position, and the return value is the wall that was hit, or -1. 
+	int sweep(Vector &start, Vector &end, Uint32 *candidates, Vector &result);
+
+	// data
+	WallList m_vertical;
+	WallList m_horizontal;
+	SDL_bool m_bIsVertical[MAX_WALLS]; // for each wall, which list it's in...
+	Uint16 m_slot[MAX_WALLS];          // ...and where in that list
+	Uint32 m_verticalMask[MASK_WORDS]; // one bit for each vertical wall
+	int m_numWalls;
+};
+
+// a uniform grid laid over the playfield, used as a broadphase for the
+// collide walls. Each cell keeps its own copy of the walls that touch it, 
+// packed together so the batch test can run straight down them. A query
+// for a rectangle (the swept box of the ball's movement) runs the batch 
+// test on the cells it covers and ORs the hits in to a mask, one bit per
+// wall. Walking that mask from the low bit up visits the walls in the same
+// order they were added, which matters because the first-hit logic in 
+// CollideWallSet::sweep relies on that order.
+class CollideGrid
+{
+public:
+	// size of a grid cell, in pixels. A ball movement in a single tick
+	// rarely covers more than a cell or two.
+	static const int CELL_SIZE = 32;
+	static const int MASK_WORDS = CollideWallSet::MASK_WORDS;
+
+	CollideGrid();
+	~CollideGrid();
+
+	// index the given walls over the part of the playfield with its top
+	// left at (x,y) and of the given size. Walls that hang off the edge of
+	// it are kept in the edge cells.
+	void build(CollideWallSet &walls, int x, int y, int width, int height);
+
+	// fills outMask with every wall that might be hit by a movement from 
+	// (x1,y1) to (x2,y2). Returns the number of walls that were looked at.
+	int query(double x1, double y1, double x2, double y2, Uint32 *outMask);
+
+	// itnernals
+	void buildList(WallList &walls, SDL_bool bIsVertical, WallList &outCellWalls, int *outCellStart);
+	void getCellRange(double x1, double y1, double x2, double y2, int &outCol1, int &outRow1, int &outCol2, int &outRow2);
+	int getCell(double pos, int numCells);
+
+	// data. The grid's top left corner is at m_originX, m_originY
+	int m_originX;
+	int m_originY;
+	int m_numCols;
+	int m_numRows;
+
+	// the walls of each cell, cell after cell. The walls for cell c 
+	// run from m_cellVerticalStart[c] to m_cellVerticalStart[c+1]
+	WallList m_cellVertical;
+	WallList m_cellHorizontal;
+	int *m_cellVerticalStart;
+	int *m_cellHorizontalStart;
+};
+
+// one solid block. The rect is the pixels the block covers, so right
+// and bottom are the last pixel that's in it, not the one past it.
+struct CollideBlock
+{
+	double m_left;
+	double m_top;
+	double m_right;
+	double m_bottom;
+};
+
+// all the solid blocks in a level, stored one record per block. 
+// 
+// The ball is a circle, and moving a circle at a rect is the same as moving
+// a point (the ball's center) at the rect grown by the ball's radius, with
+// the corners rounded off to quarter circles. That's what we test against.
+// The flat sides come out in the same place the old outset walls were, but
+// a ball coming in at a corner rolls off it the way a real ball would,
+// instead of catching on a square corner that isn't there. And it's one
+// test per block instead of four walls.
+//
+// The blocks are indexed by a grid laid over the playfield, the same way
+// the pits are (see TriggerSet), with each block in every cell its grown
+// rect touches.
+class CollideBlockSet
+{
+public:
+	// the most blocks we can hold, the number of 32 bit words in a mask
+	// with a bit per block, and the size of a grid cell in pixels. It's 
+	// enough for every block in the chunks of a streamed level that can be
+	// loaded at once (see LevelStream::MAX_ACTIVE_BLOCKS).
+	static const int MAX_BLOCKS = 2048;
+	static const int MASK_WORDS = MAX_BLOCKS/32;
+	static const int CELL_SIZE = 32;
+
+	CollideBlockSet();
+	~CollideBlockSet();
+
+	// adds the block covering the given pixels. Returns its index, 
+	// or -1 if we're full.
+	int add(int x, int y, int width, int height);
+	void clear();
+	int getCount();
+
+	// index the blocks over the part of the playfield with its top left at
+	// (x,y) and of the given size, for a ball of the given radius. This has 
+	// to be done after the blocks are added, and before anything is tested
+	// against them.
+	void build(int x, int y, int width, int height, double radius);
+
+	// fills outMask with every block that might be hit by a movement from
+	// (x1,y1) to (x2,y2). Returns the number of blocks in it. Only the words
+	// that have blocks in them get filled in, which is all sweep looks at.
+	int query(double x1, double y1, double x2, double y2, Uint32 *outMask);
+
+	// runs the real test on every block in the candidates mask, and hands back
+	// the one the movement from start to end hits first, or -1. outTime gets
+	// how far along the movement (0 to 1) the hit is, and outNormal the 
+	// direction the block's surface faces there (it's always length 1). 
+	int sweep(const Vector &start, const Vector &end, const Uint32 *candidates, double &outTime, Vector &outNormal);
+
+	// the same thing for one block. See collision.cpp for how it works
+	SDL_bool checkCollision(int block, const Vector &start, const Vector &end, double &outTime, Vector &outNormal);
+
+	// shoves a position a quarter pixel off the block, the same as a wall's 
+	// push, and bounces a velocity off of it the same way a wall does
+	static void push(const Vector &normal, Vector &pos);
+	static void bounce(Vector &vel, const Vector &normal, double minVelocity);
+
+	// itnernals
+	void getCellRange(double x1, double y1, double x2, double y2, int &outCol1, int &outRow1, int &outCol2, int &outRow2);
+	int getCell(double pos, int numCells);
+
+	// data
+	CollideBlock m_blocks[MAX_BLOCKS];
+	int m_numBlocks;
+	double m_radius;
+
+	// the grid. The blocks in cell c are m_cellBlocks[m_cellStart[c]] up
+	// to (but not including) m_cellBlocks[m_cellStart[c+1]]. Its top left
+	// corner is at m_originX, m_originY
+	int m_originX;
+	int m_originY;
+	int m_numCols;
+	int m_numRows;
+	int *m_cellStart;
+	Uint16 *m_cellBlocks;
+};
+
+// a spatial hash for finding balls that touch each other. The playfield is
+// split in to square cells, and each ball goes in the cell its center is in.
+// With cells as wide as a ball, two balls can only touch if their cells are
+// next to each other, so each ball only has to look at 9 cells worth of 
+// neighbours. Rather than keep a grid over the whole playfield, the cells are
+// hashed in to a table about twice the size of the number of balls, so the
+// memory and the work both go up with the number of balls, not the size of
+// the level.
+class BallHash
+{
+public:
+	BallHash();
+	~BallHash();
+
+	// start a new frame's worth of balls. cellSize should be at least
+	// the distance at which two balls touch.
+	void begin(int numBalls, double cellSize);
+
+	// note where ball number index is. Call this for every ball from
+	// 0 to numBalls-1 between begin and end.
+	void add(int index, double x, double y);
+	void end();
+
+	// fills outPairs with every pair of balls closer than minDist, two ints
+	// per pair, lower index first. Returns the number of pairs. If there are
+	// more than maxPairs, the rest are left out.
+	int findPairs(double minDist, int *outPairs, int maxPairs);
+
+	// itnernals
+	int getCell(double pos);
+	int getBucket(int cellX, int cellY);
+
+	// data
+	int m_numBalls;
+	int m_capacity;
+	double m_cellSize;
+	double *m_x;
+	double *m_y;
+	int *m_cellX;
+	int *m_cellY;
+
+	// the hash table. Bucket b's balls are m_sorted[m_bucketStart[b]] up 
+	// to (but not including) m_sorted[m_bucketStart[b+1]]
+	int m_numBuckets; // always a power of 2
+	int *m_bucketStart;
+	int *m_sorted;
+};
 
 #endif
 
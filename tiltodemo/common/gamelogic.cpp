@@ -6,11 +6,27 @@
 #include "geometry.h"
 #include "collision.h"
 #include "sound.h"
+#include <math.h>
 
 // This is the main game logic class. Everything related to the actual
 // game is in here. The main loop, event loop, drawing, etc. is all
 // here as well. 
 
+// every block that's loaded gets drawn as a static rect, so the graphics
+// have to have room for all of them. If they don't, the array size here
+// goes negative and this won't compile.
+typedef char StaticRectsHoldAllBlocks[GameLogic::MAX_BLOCKS <= MAX_STATIC_RECTS ? 1 : -1];
+
+// hands a range of balls from the thread pool to GameLogic::stepBalls
+class BallStepJob : public ParallelJob
+{
+public:
+	BallStepJob(GameLogic *game) { m_game = game; }
+	virtual void run(int begin, int end, int) { m_game->stepBalls(begin, end); }
+
+	GameLogic *m_game;
+};
+
 GameLogic::GameLogic()
 {
 	// because ANSI (for some reason) won't let you init a double
@@ -27,10 +43,61 @@ GameLogic::GameLogic()
 	// initialization is done in init(). But we clear these values in case
 	// a GameLogic is ever instanced, then deleted before init() is called. 
 	// We care because these values are used in the destructor.
-	m_numCollideWalls = 0;
 	m_numBlocks = 0;
 	m_numPits = 0;
+	m_bCollideGridDirty = SDL_TRUE;
+	m_bTriggersDirty = SDL_TRUE;
+	m_bStaticRectsDirty = SDL_TRUE;
+	m_wallsTested = 0;
+	m_totalWallsTested = 0;
+	m_totalSteps = 0;
 	img_ball = NULL;
+	img_exit = NULL;
+	img_pit = NULL;
+	m_wallHitSound = NULL;
+	m_gameLoseSound = NULL;
+	m_gameWinSound = NULL;
+
+	// we're not recording, and we have a screen. See setRecordFile and replay
+	m_recordFile = NULL;
+	m_bHeadless = SDL_FALSE;
+
+	// the stats at the end of run() are off unless they're asked for
+	m_bPrintStats = SDL_FALSE;
+
+	// run the physics at a fixed rate by default. See tick()
+	m_bFixedStep = SDL_TRUE;
+	m_fixedStepMs = 1000.0/(double)FIXED_STEP_HZ;
+	m_stepAccumulator = 0.0;
+	m_renderAlpha = 1.0;
+
+	// awake, and we haven't drawn anything yet
+	m_bAsleep = SDL_FALSE;
+	m_bWatchingTilt = SDL_FALSE;
+	m_bNeedsDraw = SDL_TRUE;
+	m_totalSleepTicks = 0;
+
+	// the built in level, until we're told otherwise. See setLevelFile
+	m_levelFile = NULL;
+	m_levelWidth = SCREEN_WIDTH;
+	m_levelHeight = SCREEN_HEIGHT;
+	m_startX = 20;
+	m_startY = 20;
+	m_cameraX = 0;
+	m_cameraY = 0;
+	m_gridRect.x = 0;
+	m_gridRect.y = 0;
+	m_gridRect.w = SCREEN_WIDTH;
+	m_gridRect.h = SCREEN_HEIGHT;
+
+	// the regular game has just the one ball. See setNumBalls
+	m_balls = new Ball[1];
+	m_numBalls = 1;
+	m_randomSeed = 1;
+	m_bBallCollisions = SDL_TRUE;
+	m_maxBallPairs = MAX_PAIRS_PER_BALL;
+	m_ballPairs = new int[m_maxBallPairs*2];
+	m_ballPairsFound = 0;
 }
 
 GameLogic::~GameLogic()
@@ -40,11 +107,9 @@ GameLogic::~GameLogic()
 	freeImage(img_exit);
 	freeImage(img_pit);
 
-	// clear out those collide walls
-	for ( int i=0 ; i<m_numCollideWalls ; i++ )
-	{
-		delete m_collideWalls[i];
-	}
+	// the balls
+	delete [] m_balls;
+	delete [] m_ballPairs;
 
 	// clear out the blocks
 	for ( int i=0 ; i<m_numBlocks; i++ )
@@ -52,12 +117,6 @@ GameLogic::~GameLogic()
 		delete m_blocks[i];
 	}
 
-	// clear out the pits
-	for ( int i=0 ; i<m_numPits ; i++ )
-	{
-		delete m_pits[i];
-		delete m_pitDisplays[i];
-	}
 }
 
 // called from main, this is the main run function of our game. 
@@ -66,17 +125,72 @@ void GameLogic::run()
 	// get the stuff we need
 	init();
 
+	// save the game, if we were asked to. What we need to know to set the
+	// level up the same way goes at the top of the file.
+	if ( m_recordFile != NULL )
+	{
+		int flags = 0;
+		if ( m_bFixedStep ) flags |= InputLog::FLAG_FIXED_STEP;
+		if ( m_bBallCollisions ) flags |= InputLog::FLAG_BALL_COLLISIONS;
+		m_inputLog.startRecording(m_recordFile, flags, m_ballRadius, m_numBalls, getLevelHash());
+	}
+
 	m_bGameRunning = SDL_TRUE;
 	while ( m_bGameRunning ) 
 	{
 		eventloop();
 		tick();
-		draw();
+
+		// if nothing has moved, the last frame is still on the screen
+		// and still right. No need to draw it again.
+		if ( m_bNeedsDraw )
+		{
+			draw();
+			m_bNeedsDraw = SDL_FALSE;
+		}
 
 		// You should always have a little delay (recommend 10ms)
 		// at the end of your event loop. This keeps SDL from
-		// hogging all the CPU time. 
-		SDL_Delay(10); 
+		// hogging all the CPU time. While everything's asleep we wait a 
+		// bit longer, which is easier on the battery. Tilting the phone
+		// still wakes us up fast enough that nobody will notice.
+		SDL_Delay(m_bAsleep ? ASLEEP_DELAY_MS : 10); 
+	}
+
+	// how the run went, if it was asked for (-stats, see main.cpp)
+	if ( m_bPrintStats )
+	{
+		printStats();
+	}
+	m_inputLog.stopRecording();
+}
+
+// prints how hard the collision code had to work, and how the drawing
+// went. For finding out where the time goes, not something a player
+// needs to see.
+void GameLogic::printStats()
+{
+	// how hard the collision code had to work
+	if ( m_totalSteps > 0 )
+	{
+		printf("Walls tested per step: %.2f\n", (double)m_totalWallsTested/(double)m_totalSteps);
+	}
+	printf("Ticks spent asleep: %u\n", m_totalSleepTicks);
+	if ( m_levelStream.isOpen() )
+	{
+		printf("Level chunks loaded: %u, waited for: %u\n", m_levelStream.m_numLoads, m_levelStream.m_numWaits);
+	}
+
+	// and how long we sat waiting for the screen
+	Uint32 framesPresented, presentBlockedMs;
+	getPresentStats(framesPresented, presentBlockedMs);
+	if ( framesPresented > 0 )
+	{
+		printf("Frames: %u, blocked in present: %u ms (%.2f ms a frame)\n", framesPresented, presentBlockedMs, (double)presentBlockedMs/(double)framesPresented);
+
+		Uint32 frameIssued, frameSkipped, totalIssued, totalSkipped;
+		getGLCallStats(frameIssued, frameSkipped, totalIssued, totalSkipped);
+		printf("GL calls a frame: %.1f, redundant ones skipped: %.1f\n", (double)totalIssued/(double)framesPresented, (double)totalSkipped/(double)framesPresented);
 	}
 }
 
@@ -107,6 +221,7 @@ void GameLogic::eventloop()
 				int accelerometer = ev.jaxis.axis;
 				int val = ev.jaxis.value;
 				updateAccelerometer(accelerometer, val);
+				m_inputLog.recordAxis(accelerometer, val);
 			}
 			break;
 		}
@@ -121,174 +236,746 @@ void GameLogic::tick()
 	int ms = ticks - m_lastTicks;
 	m_lastTicks = ticks;
 
+	// if we're recording, this is the other half of what we need 
+	// to play the game back. The accelerometer is the first half
+	// (see eventloop)
+	m_inputLog.recordTick(ms);
+	tick(ms);
+
+	// and point the camera at wherever the ball is going to be drawn
+	updateCamera();
+}
+
+void GameLogic::tick(int ms)
+{
 	// this is a very handy way to keep things under control
 	// when you're debugging. This way, when you break in a function and
 	// look around for a while, the following game loop doesn't have a
 	// huge ticks value since the last loop. 
 	if ( ms > 100 ) ms = 100;
 
+	// tilting the phone wakes up every ball that's asleep, even if some
+	// of the others never went to sleep. 
+	if ( m_bWatchingTilt && accelerometerMoved() )
+	{
+		wake();
+	}
+
+	// while everything is asleep, there's nothing to do until the phone
+	// gets tilted, or the level changes under the balls.
+	if ( m_bAsleep )
+	{
+		if ( !m_bCollideGridDirty && !m_bTriggersDirty )
+		{
+			m_totalSleepTicks++;
+			return;
+		}
+		wake();
+	}
+	m_bNeedsDraw = SDL_TRUE;
+
+	if ( !m_bFixedStep )
+	{
+		// the simple way. Move the physics along by however long the
+		// last frame took, and draw exactly where the ball ended up.
+		step(ms);
+		m_renderAlpha = 1.0;
+		return;
+	}
+
+	// fixed step. The physics always moves along in steps of exactly
+	// m_fixedStepMs, so it behaves the same no matter how fast we're 
+	// drawing. Time that's left over (less than a step) is saved up for
+	// the next frame. 
+	m_stepAccumulator += ms;
+	int numSteps = 0;
+	while ( m_stepAccumulator >= m_fixedStepMs )
+	{
+		// if we've fallen so far behind that we'd need more than
+		// MAX_SUBSTEPS to catch up, just let the extra time go. Otherwise
+		// a slow frame makes for more steps, which makes for a slower 
+		// frame, and so on. 
+		if ( numSteps >= MAX_SUBSTEPS )
+		{
+			m_stepAccumulator = 0.0;
+			break;
+		}
+
+		// if that last step put everything to sleep, the rest of
+		// the steps wouldn't do anything
+		if ( m_bAsleep )
+		{
+			m_stepAccumulator = 0.0;
+			break;
+		}
+
+		step(m_fixedStepMs);
+		m_stepAccumulator -= m_fixedStepMs;
+		numSteps++;
+	}
+
+	// the balls are drawn somewhere between where they were before the last
+	// step and where they are now, depending on how much time is left over. 
+	// That keeps the motion smooth when the drawing rate and the 
+	// physics rate don't line up.
+	m_renderAlpha = m_stepAccumulator/m_fixedStepMs;
+}
+
+void GameLogic::step(double ms)
+{
 	// apply the current accelerations to the velocity
 	// to do that, we first must figure out the accelerations.
 	// We are getting values from -1.0 to 1.0 from our 
 	// accelerometer management code (see accelerometer.cpp). 
 	// so we simply multiply that ratio value by our gravity constant.
-	double accX = getAccelerometerX()*GRAVITY_ACC_PPSPS;
-	double accY = getAccelerometerY()*GRAVITY_ACC_PPSPS;
+	// Every ball feels the same tilt, so we work this out once here
+	// and stepBall picks it up from m_stepAccX and m_stepAccY
+	m_stepMs = ms;
+	m_stepAccX = getAccelerometerX()*GRAVITY_ACC_PPSPS;
+	m_stepAccY = getAccelerometerY()*GRAVITY_ACC_PPSPS;
+
+	// in a streamed level, make sure everything the balls can get to
+	// this step is loaded. That may change what's in the collide grid.
+	if ( m_levelStream.isOpen() )
+	{
+		updateLevelStream();
+	}
+
+	// the collide grid has to be up to date before any of the balls
+	// use it. From here until the balls are done, the level is read only.
+	if ( m_bCollideGridDirty )
+	{
+		buildCollideGrid();
+	}
+	if ( m_bTriggersDirty )
+	{
+		buildTriggers();
+	}
+
+	// move all the balls. With just the one ball, this is no different
+	// from calling stepBall on it. With a lot of balls, the thread pool
+	// spreads them out over the CPUs. Each ball only ever touches its own
+	// data, so the balls can go in any order, on any thread.
+	BallStepJob job(this);
+	m_threadPool.parallelFor(&job, m_numBalls, BALLS_PER_CHUNK);
+
+	// the balls have all moved and bounced off the walls. Now they
+	// bounce off of each other.
+	if ( m_bBallCollisions && m_numBalls > 1 )
+	{
+		collideBalls();
+	}
+
+	// now go back over the balls on this thread, check where they ended up,
+	// and deal with anything that happened to them. This is where the sounds
+	// get played, and the game (or the ball) gets reset, since none of that 
+	// is safe to do from the workers.
+	m_wallsTested = 0;
+	m_totalSteps++;
+	SDL_bool bHitWall = SDL_FALSE;
+	SDL_bool bFellInPit = SDL_FALSE;
+	SDL_bool bReachedExit = SDL_FALSE;
+	int numAsleep = 0;
+	for ( int i=0 ; i<m_numBalls ; i++ )
+	{
+		Ball &ball = m_balls[i];
+		m_wallsTested += ball.m_wallsTested;
+
+		// last of all, the pits and the exit
+		checkTriggers(ball);
+
+		// and whether it's been sitting still long enough to go to sleep
+		updateRest(ball);
+		if ( ball.m_bAsleep ) numAsleep++;
+
+		if ( ball.m_events & Ball::HIT_WALL ) bHitWall = SDL_TRUE;
+
+		if ( ball.m_events & Ball::IN_PIT )
+		{
+			bFellInPit = SDL_TRUE;
+			resetBall(i);
+		}
+		else if ( ball.m_events & Ball::AT_EXIT )
+		{
+			bReachedExit = SDL_TRUE;
+			resetBall(i);
+		}
+	}
+	m_totalWallsTested += m_wallsTested;
+
+	// as soon as any ball is asleep, we keep an eye on the accelerometer
+	// so tick() can wake it back up. We only start watching when the first
+	// one drops off, so the tilt is measured from where it was then, not
+	// from wherever it's crept to since. (a ball that was reset above, or
+	// got bumped by another one, is awake again)
+	if ( numAsleep > 0 && !m_bWatchingTilt )
+	{
+		watchAccelerometer(WAKE_TILT_PERCENT/100.0);
+		m_bWatchingTilt = SDL_TRUE;
+	}
+	else if ( numAsleep == 0 && m_bWatchingTilt )
+	{
+		watchAccelerometer(0.0);
+		m_bWatchingTilt = SDL_FALSE;
+	}
+
+	// once they're all asleep, so is the game. From here, tick() waits for
+	// the phone to move.
+	if ( numAsleep == m_numBalls )
+	{
+		m_bAsleep = SDL_TRUE;
+		m_renderAlpha = 1.0;
+	}
+
+	// and finally, hitting a wall means we play the
+	// collide sound. Just the once, no matter how many
+	// walls we hit this step.
+	if ( bHitWall && !m_bHeadless )
+	{
+		playSound(m_wallHitSound);
+	}
+
+	if ( bFellInPit )
+	{
+		// fell in to a pit.
+		// CG: Added a you lose sound
+		if ( !m_bHeadless ) playSound(m_gameLoseSound);
+	}
+	else if ( bReachedExit )
+	{
+		// they win the game! Their reward is a brief pause followed by
+		// the game resetting. Ah what a warm feeling that will give them
+		// CG: Added a victory sound
+		if ( !m_bHeadless ) playSound(m_gameWinSound);
+
+		// the pause is only for the real game. In a stress scene with
+		// a pile of balls, they'd be hitting the exit all the time. And
+		// there's nobody watching a replay.
+		if ( m_numBalls == 1 && !m_bHeadless )
+		{
+			SDL_Delay(1000); 
+		}
+	}
+}
+
+void GameLogic::stepBalls(int begin, int end)
+{
+	for ( int i=begin ; i<end ; i++ )
+	{
+		stepBall(m_balls[i]);
+	}
+}
+
+void GameLogic::stepBall(Ball &ball)
+{
+	// this gets called from the worker threads, so it must only
+	// change the ball it was given. Anything that needs doing to the
+	// rest of the game gets noted in ball.m_events, for step() to 
+	// take care of afterwards.
+	double ms = m_stepMs;
+	ball.m_prevPos.set(ball.m_pos);
+	ball.m_events = 0;
+	ball.m_wallsTested = 0;
+
+	// a sleeping ball stays put
+	if ( ball.m_bAsleep )
+	{
+		return;
+	}
 
 	// the function applyPPSVel applies the sent in 
 	// pixels-per-second velocity to the start value, 
 	// ratioed to the number of milliseconds sent in. 
 	// the process is exactly the same when applying an acceleration
 	// to a velocity. 
-	m_ballVel.m_x = applyPPSVel(m_ballVel.m_x, accX, ms);
-	m_ballVel.m_y = applyPPSVel(m_ballVel.m_y, accY, ms);
-
-	// now the ball's velocity is updated. Apply it to the ball's location
-	// this tiem we use a different version of applyPPSVel. This one takes
-	// vectors (instead of doubles). Rather than updating the ball's 
-	// position, it merely puts the resultant position into "wantPos". 
-	// We still need to do collision detection, so we need the start and 
-	// end positions of the bal to be distinct entities.
-	Vector wantPos;
-	applyPPSVel(m_ballPos, m_ballVel, ms, wantPos);
-
-	// now we have the ball's start and end location
-	// check to see if it hit any colliders. The new 
-	// position will ultimately be in postCollision
-	Vector postCollision;
-	CollideWall *collidedWith = NULL;
-	for ( int i=0 ; i<m_numCollideWalls ; i++ )
-	{
-		SDL_bool bCollided = m_collideWalls[i]->checkCollision(m_ballPos, wantPos, postCollision);
-		if ( bCollided )
+	ball.m_vel.m_x = applyPPSVel(ball.m_vel.m_x, m_stepAccX, ms);
+	ball.m_vel.m_y = applyPPSVel(ball.m_vel.m_y, m_stepAccY, ms);
+
+	// now we have to move the ball, bouncing it off of anything it hits
+	// along the way. We do this in legs. Each leg moves the ball along its
+	// velocity for whatever time is left in this step. If the leg hits a 
+	// wall, we stop there, bounce, and start a new leg from that point with
+	// the time that's left. That way a fast ball doesn't lose distance when
+	// it bounces, and it can't end up past a second wall it should have 
+	// hit on the way back out. Once we've bounced MAX_BOUNCES times in one
+	// step, we give up on the rest of the time. That only happens when the 
+	// ball is stuck rattling around in a tight spot.
+	double remainingMs = ms;
+	for ( int bounce=0 ; bounce<MAX_BOUNCES ; bounce++ )
+	{
+		// Apply the velocity to the ball's location.
+		// this tiem we use a different version of applyPPSVel. This one takes
+		// vectors (instead of doubles). Rather than updating the ball's 
+		// position, it merely puts the resultant position into "wantPos". 
+		// We still need to do collision detection, so we need the start and 
+		// end positions of the bal to be distinct entities.
+		Vector wantPos;
+		applyPPSVel(ball.m_pos, ball.m_vel, remainingMs, wantPos);
+
+		// now we have the ball's start and end location
+		// check to see if it hit any colliders. First the blocks. Each 
+		// one knows exactly when the ball hits it, so we get back how far
+		// along the movement (0 to 1) the first hit was, and which way the
+		// block faces there. Rather than test every block in the level, we
+		// ask for the ones near the movement.
+		Uint32 nearBlocks[CollideBlockSet::MASK_WORDS];
+		ball.m_wallsTested += m_collideBlocks.query(ball.m_pos.m_x, ball.m_pos.m_y, wantPos.m_x, wantPos.m_y, nearBlocks);
+		double blockTime;
+		Vector blockNormal;
+		int blockHit = m_collideBlocks.sweep(ball.m_pos, wantPos, nearBlocks, blockTime, blockNormal);
+		Vector endPos;
+		endPos.set(wantPos);
+		if ( blockHit >= 0 )
 		{
-			// we collided with something. postCollision will be set to the point
-			// where we should stop. Change our new destination to be that, and
-			// continue with the loop. We may have hit multiple collision walls
-			// in a single tick. We want to stop at whichever one we hit first. Doing
-			// this guarantees that whichever one we hit first ends up being the
-			// last one that registers a collision. All the colliders we hit that are 
-			// before the winner in the array will end up putting postCollision further than 
-			// where we hit the winner. All of the colliders after the winner will not 
-			// register a collision at all, because the winner will have put postCollision
-			// to a point before the movement intersected them. 
-			wantPos.set(postCollision);
-			collidedWith = m_collideWalls[i];
+			endPos.setXY(ball.m_pos.m_x + (wantPos.m_x - ball.m_pos.m_x)*blockTime, ball.m_pos.m_y + (wantPos.m_y - ball.m_pos.m_y)*blockTime);
 		}
-	}
 
-	// we're done checking for collisions. wantPos will now be the
-	// correct location for the ball.
-	m_ballPos.set(wantPos);
+		// then the walls around the edge of the level, as far as the block
+		// let us get. Rather than test every wall in the level, we ask the
+		// collide grid for the walls near the box swept out by this movement.
+		Uint32 nearWalls[CollideWallSet::MASK_WORDS];
+		int tested = m_collideGrid.query(ball.m_pos.m_x, ball.m_pos.m_y, wantPos.m_x, wantPos.m_y, nearWalls);
+		ball.m_wallsTested += tested;
 
-	// did we collide with anything?
-	if ( collidedWith != NULL )
-	{
-		// we collided. We need to apply that collider's 
-		// push value to our location. This shoves us off the wall
-		// a bit, to keep us from being right on it.
-		collidedWith->push(m_ballPos);
+		// now run the real collision test on just those walls. It
+		// hands back the wall we hit first (or -1 if we didn't hit
+		// anything), and puts the point where we should stop in to stopPos.
+		// If it hits one, it got there before the block did.
+		Vector stopPos;
+		int collidedWith = m_collideWalls.sweep(ball.m_pos, endPos, nearWalls, stopPos);
+		if ( collidedWith >= 0 )
+		{
+			blockHit = -1;
+		}
 
-		// colliding changes our velocity.
-		// we bounce.
-		if ( collidedWith->m_bIsVertical )
+		// did we collide with anything?
+		if ( collidedWith < 0 && blockHit < 0 )
 		{
-			// it's a vertical wall. Our x
-			// velocity needs to reverse. Our
-			// y velocity is unaffected
-			// CG: Reduce the x velocity by 25%, and reduce it to 0 if it's less
-			// than MINIMUM_REBOUND_VELOCITY
-			m_ballVel.m_x = -0.25 * m_ballVel.m_x;
-			if ((m_ballVel.m_x * m_ballVel.m_x) < (MINIMUM_REBOUND_VELOCITY*MINIMUM_REBOUND_VELOCITY)) {
-				m_ballVel.m_x = 0;
-			}
+			// nope. The ball makes it all the way, and we're done. Unless it
+			// went through a pit or the exit along the way, of course.
+			sweepTriggers(ball, ball.m_pos, wantPos);
+			ball.m_pos.set(wantPos);
+			break;
+		}
+
+		// we only made it as far as the wall. If we fell in a pit
+		// before we got there, that's the end of the ball's step.
+		if ( sweepTriggers(ball, ball.m_pos, stopPos) )
+		{
+			ball.m_pos.set(stopPos);
+			break;
+		}
+
+		if ( blockHit >= 0 )
+		{
+			// we hit a block, and we already know how much of the leg it took
+			// to get there. Push off of it a bit, and bounce off of its 
+			// surface where we hit. On one of its sides that's just like a
+			// wall. On one of its rounded corners, the ball gets turned.
+			remainingMs -= remainingMs*blockTime;
+			ball.m_pos.set(stopPos);
+			ball.m_events |= Ball::HIT_WALL;
+			CollideBlockSet::push(blockNormal, ball.m_pos);
+			CollideBlockSet::bounce(ball.m_vel, blockNormal, MINIMUM_REBOUND_VELOCITY);
 		}
 		else
 		{
-			// it's a horizontal wall. Our y
-			// velocity needs to reverse. Our
-			// x velocity is unaffected
-			// CG: Reduce the y velocity by 25%, and reduce it to 0 if it's less
+			// we collided with a wall. Work out how much of this leg's time it took to
+			// get to the wall. Walls are straight up and down or across, so
+			// we only need to look at the one direction the wall stops us in.
+			// (the ball is crossing the wall, so that direction can't be 0)
+			SDL_bool bVerticalWall = m_collideWalls.isVertical(collidedWith);
+			double usedRatio;
+			if ( bVerticalWall )
+			{
+				usedRatio = VerticalWall::getUsedRatio(ball.m_pos, wantPos, stopPos);
+			}
+			else
+			{
+				usedRatio = HorizontalWall::getUsedRatio(ball.m_pos, wantPos, stopPos);
+			}
+			remainingMs -= remainingMs*usedRatio;
+			ball.m_pos.set(stopPos);
+			ball.m_events |= Ball::HIT_WALL;
+
+			// We need to apply that collider's 
+			// push value to our location. This shoves us off the wall
+			// a bit, to keep us from being right on it.
+			m_collideWalls.push(collidedWith, ball.m_pos);
+
+			// colliding changes our velocity.
+			// we bounce. The velocity across the wall reverses, and
+			// the velocity along it is unaffected.
+			// CG: Reduce the velocity by 25%, and reduce it to 0 if it's less
 			// than MINIMUM_REBOUND_VELOCITY
-			m_ballVel.m_y = -0.25 * m_ballVel.m_y;
-			if ((m_ballVel.m_y * m_ballVel.m_y) < (MINIMUM_REBOUND_VELOCITY*MINIMUM_REBOUND_VELOCITY)) {
-				m_ballVel.m_y = 0;
+			if ( bVerticalWall )
+			{
+				VerticalWall::bounce(ball.m_vel, MINIMUM_REBOUND_VELOCITY);
+			}
+			else
+			{
+				HorizontalWall::bounce(ball.m_vel, MINIMUM_REBOUND_VELOCITY);
 			}
 		}
 
 		// we'll say an arbitrary 25%
 		// of the ball's velocity is lost in the collision
-		// m_ballVel.setLength(0.75*m_ballVel.getLength());
+		// ball.m_vel.setLength(0.75*ball.m_vel.getLength());
 		// CG: Trying a different physics method, within the individual direction changes.
 
-		// and finally, hitting a wall means we play the
-		// collide sound
-		playSound(m_wallHitSound);
+		// if the bounce took all the time, or stopped us dead, there's
+		// nothing left to move
+		if ( remainingMs <= 0.0 || (ball.m_vel.m_x == 0 && ball.m_vel.m_y == 0) )
+		{
+			break;
+		}
 	}
+}
 
-	// now we're done with collision detection. The ball's position
-	// is correctly set. Now it's time to check for pits. 
-	for ( int i=0 ; i<m_numPits ; i++ )
+void GameLogic::collideBalls()
+{
+	// Two balls touch when their centers are closer than two radiuses. 
+	// Rather than check every ball against every other ball, we drop them
+	// all in to a spatial hash with cells that size, and ask it for the pairs
+	// that are close enough. (see BallHash in collision.cpp)
+	double minDist = m_ballRadius*2;
+	m_ballHash.begin(m_numBalls, minDist);
+	for ( int i=0 ; i<m_numBalls ; i++ )
+	{
+		m_ballHash.add(i, m_balls[i].m_pos.m_x, m_balls[i].m_pos.m_y);
+	}
+	m_ballHash.end();
+
+	int numPairs = m_ballHash.findPairs(minDist, m_ballPairs, m_maxBallPairs);
+	m_ballPairsFound = numPairs;
+
+	// pushing one pair apart can push one of them in to a third ball, or a
+	// wall can stop a ball from moving out of the way. So we go over the
+	// pairs a few times, which lets the pushes spread through a pile of balls.
+	for ( int iteration=0 ; iteration<BALL_SOLVER_ITERATIONS ; iteration++ )
 	{
-		if ( ptInRect((int)m_ballPos.m_x, (int)m_ballPos.m_y, m_pits[i]) )
+		for ( int i=0 ; i<numPairs ; i++ )
 		{
-			// fell in to a pit.
-			// CG: Added a you lose sound
-			playSound(m_gameLoseSound);
-			reset();
-			return;
+			Ball &a = m_balls[m_ballPairs[i*2]];
+			Ball &b = m_balls[m_ballPairs[i*2+1]];
+
+			// two sleeping balls that settled against each other stay 
+			// that way. A ball that gets bumped by one that's awake wakes up.
+			if ( a.m_bAsleep && b.m_bAsleep ) continue;
+			if ( a.m_bAsleep || b.m_bAsleep )
+			{
+				Ball &sleeper = a.m_bAsleep ? a : b;
+				sleeper.m_bAsleep = SDL_FALSE;
+				sleeper.m_restMs = 0.0;
+			}
+
+			// an earlier pair may have already pushed these two apart
+			Vector normal;
+			normal.set(b.m_pos);
+			normal.subtractVector(a.m_pos);
+			double distSq = normal.getLengthSq();
+			if ( distSq >= minDist*minDist ) continue;
+
+			// the direction from a to b. If they're sitting exactly on top
+			// of each other, any direction will do.
+			double dist = sqrt(distSq);
+			if ( dist > 0.0 )
+			{
+				normal.scalarDivide(dist);
+			}
+			else
+			{
+				normal.setXY(1, 0);
+			}
+
+			// shove them apart, half the overlap each. They move through the 
+			// regular wall collision, so this can't push a ball through a wall.
+			double halfOverlap = (minDist - dist)*0.5;
+			Vector target;
+			target.setXY(a.m_pos.m_x - normal.m_x*halfOverlap, a.m_pos.m_y - normal.m_y*halfOverlap);
+			moveBallTo(a, target);
+			target.setXY(b.m_pos.m_x + normal.m_x*halfOverlap, b.m_pos.m_y + normal.m_y*halfOverlap);
+			moveBallTo(b, target);
+
+			// now bounce them, if they're heading toward each other. The balls
+			// all weigh the same, so they swap the part of their velocity along 
+			// the line between them. Then, as with the walls, we only keep a 
+			// quarter of that.
+			double closing = (b.m_vel.m_x - a.m_vel.m_x)*normal.m_x + (b.m_vel.m_y - a.m_vel.m_y)*normal.m_y;
+			if ( iteration == 0 && closing < 0.0 )
+			{
+				double impulse = (1.0 + 0.25)*closing*0.5;
+				a.m_vel.m_x += normal.m_x*impulse;
+				a.m_vel.m_y += normal.m_y*impulse;
+				b.m_vel.m_x -= normal.m_x*impulse;
+				b.m_vel.m_y -= normal.m_y*impulse;
+			}
 		}
 	}
+}
 
-	// and finally, see if they hit the exit
-	if ( ptInRect((int)m_ballPos.m_x, (int)m_ballPos.m_y, &m_exitRect) )
+void GameLogic::moveBallTo(Ball &ball, Vector &target)
+{
+	// moves the ball straight to target, unless there's a block or a wall
+	// in the way. In that case it stops there. Same order as stepBall: 
+	// the blocks, then the walls up to where the block stopped us.
+	Uint32 nearBlocks[CollideBlockSet::MASK_WORDS];
+	ball.m_wallsTested += m_collideBlocks.query(ball.m_pos.m_x, ball.m_pos.m_y, target.m_x, target.m_y, nearBlocks);
+	double blockTime;
+	Vector blockNormal;
+	int blockHit = m_collideBlocks.sweep(ball.m_pos, target, nearBlocks, blockTime, blockNormal);
+	Vector endPos;
+	endPos.set(target);
+	if ( blockHit >= 0 )
 	{
-		// they win the game! Their reward is a brief pause followed by
-		// the game resetting. Ah what a warm feeling that will give them
-		// CG: Added a victory sound
-		playSound(m_gameWinSound);
-		SDL_Delay(1000); 
-		reset();
-		return;
+		endPos.setXY(ball.m_pos.m_x + (target.m_x - ball.m_pos.m_x)*blockTime, ball.m_pos.m_y + (target.m_y - ball.m_pos.m_y)*blockTime);
+	}
+
+	Uint32 nearWalls[CollideWallSet::MASK_WORDS];
+	ball.m_wallsTested += m_collideGrid.query(ball.m_pos.m_x, ball.m_pos.m_y, target.m_x, target.m_y, nearWalls);
+
+	Vector stopPos;
+	int collidedWith = m_collideWalls.sweep(ball.m_pos, endPos, nearWalls, stopPos);
+	ball.m_pos.set(stopPos);
+	if ( collidedWith >= 0 )
+	{
+		m_collideWalls.push(collidedWith, ball.m_pos);
+	}
+	else if ( blockHit >= 0 )
+	{
+		CollideBlockSet::push(blockNormal, ball.m_pos);
+	}
+}
+
+SDL_bool GameLogic::sweepTriggers(Ball &ball, Vector &start, Vector &end)
+{
+	// checks the pits and the exit against the whole of a leg of the ball's
+	// movement, not just where it ends up. Otherwise a fast enough ball
+	// could skip right over a pit. If it went in to more than one, the 
+	// first one it got to wins. Returns true if it went in to any.
+	int hits[MAX_TRIGGER_HITS];
+	double times[MAX_TRIGGER_HITS];
+	int numHits = m_triggers.querySegment(start.m_x, start.m_y, end.m_x, end.m_y, hits, times, MAX_TRIGGER_HITS);
+
+	int events = 0;
+	double firstTime = 2.0;
+	for ( int i=0 ; i<numHits ; i++ )
+	{
+		int event = 0;
+		switch ( m_triggers.getType(hits[i]) )
+		{
+		case TRIGGER_PIT:
+			event = Ball::IN_PIT;
+			break;
+		case TRIGGER_EXIT:
+			event = Ball::AT_EXIT;
+			break;
+		}
+
+		// a pit beats the exit if the ball gets to both at once
+		if ( event == 0 ) continue;
+		if ( times[i] < firstTime || (times[i] == firstTime && event == Ball::IN_PIT) )
+		{
+			events = event;
+			firstTime = times[i];
+		}
+	}
+
+	ball.m_events |= events;
+	return events != 0 ? SDL_TRUE : SDL_FALSE;
+}
+
+void GameLogic::checkTriggers(Ball &ball)
+{
+	// stepBall has already checked the ball's path on the way here. If
+	// it went in to something, we're done.
+	if ( ball.m_events & (Ball::IN_PIT | Ball::AT_EXIT) ) return;
+
+	// but the ball may have been shoved somewhere by another ball since
+	// then, so check again where it is now. The trigger set hands back
+	// just the ones the ball is in, rather than us going through them all.
+	int hits[MAX_TRIGGER_HITS];
+	int numHits = m_triggers.queryPoint((int)ball.m_pos.m_x, (int)ball.m_pos.m_y, hits, MAX_TRIGGER_HITS);
+
+	int events = 0;
+	for ( int i=0 ; i<numHits ; i++ )
+	{
+		switch ( m_triggers.getType(hits[i]) )
+		{
+		case TRIGGER_PIT:
+			events |= Ball::IN_PIT;
+			break;
+		case TRIGGER_EXIT:
+			events |= Ball::AT_EXIT;
+			break;
+		}
+	}
+
+	// falling in to a pit beats reaching the exit
+	if ( events & Ball::IN_PIT )
+	{
+		// fell in to a pit.
+		ball.m_events |= Ball::IN_PIT;
+	}
+	else if ( events & Ball::AT_EXIT )
+	{
+		ball.m_events |= Ball::AT_EXIT;
 	}
 }
 
 void GameLogic::draw()
 {
+	// everything in the level is drawn relative to the camera. In the 
+	// built in level, that's always at 0,0 and this doesn't change anything.
+	int camX = m_cameraX;
+	int camY = m_cameraY;
+
 	// clear the screen
 	fillRect(0, 0, SCREEN_WIDTH, SCREEN_HEIGHT, 0);
 
-	// now draw the blocks
-	for ( int i=0 ; i<m_numBlocks ; i++ )
+	// now draw the blocks. They don't move, so they only get handed to the
+	// graphics when they change, and then it's one draw for all of them.
+	// In a big level, only the ones near the ball are even loaded.
+	if ( m_bStaticRectsDirty )
 	{
-		fillRect(m_blocks[i]->x, m_blocks[i]->y, m_blocks[i]->w, m_blocks[i]->h, 0x0000ff);
+		clearStaticRects();
+		for ( int i=0 ; i<m_numBlocks ; i++ )
+		{
+			SDL_Rect &rc = *m_blocks[i];
+			addStaticRect(rc.x, rc.y, rc.w, rc.h, 0x0000ff);
+		}
+		m_bStaticRectsDirty = SDL_FALSE;
 	}
+	drawStaticRects(camX, camY);
 
 	// and now the pits
 	for ( int i=0 ; i<m_numPits ; i++ )
 	{
-		// fillRect(m_pitDisplays[i]->x, m_pitDisplays[i]->y, m_pitDisplays[i]->w, m_pitDisplays[i]->h, 0xffffff);
+		SDL_Rect &rc = m_pitDisplays[i];
+		if ( rc.x - camX >= SCREEN_WIDTH || rc.y - camY >= SCREEN_HEIGHT || rc.x + rc.w <= camX || rc.y + rc.h <= camY ) continue;
+
+		// fillRect(rc.x - camX, rc.y - camY, rc.w, rc.h, 0xffffff);
 		// Uncomment the above line and comment the next to switch from a pit image to a solid white block
-		drawImage(img_pit, m_pitDisplays[i]->x, m_pitDisplays[i]->y);
+		drawImage(img_pit, rc.x - camX, rc.y - camY);
 
 	}
 
 	// finally, the exit
-	// fillRect(m_exitRect.x, m_exitRect.y, m_exitRect.w, m_exitRect.h, 0xff0000);
+	// fillRect(m_exitRect.x - camX, m_exitRect.y - camY, m_exitRect.w, m_exitRect.h, 0xff0000);
 	// Uncomment the above line and comment the next to switch from an exit image to a solid red block
-	drawImage(img_exit, m_exitRect.x, m_exitRect.y);
+	drawImage(img_exit, m_exitRect.x - camX, m_exitRect.y - camY);
 
-	// draw the ball. Remember the ball pos is 
+	// draw the balls. Remember the ball pos is 
 	// for the *centeR* of the ball. We need to tell it 
 	// the location of the top left. So we subtract the
-	// radius from it.
-	int ballDrawX = (int)m_ballPos.m_x - m_ballRadius;
-	int ballDrawY = (int)m_ballPos.m_y - m_ballRadius;
-	drawImage(img_ball, ballDrawX, ballDrawY);
+	// radius from it. When running a fixed step, the ball is
+	// drawn part way between its last two physics positions
+	// (see tick)
+	for ( int i=0 ; i<m_numBalls ; i++ )
+	{
+		Ball &ball = m_balls[i];
+		double ballX = ball.m_prevPos.m_x + (ball.m_pos.m_x - ball.m_prevPos.m_x)*m_renderAlpha;
+		double ballY = ball.m_prevPos.m_y + (ball.m_pos.m_y - ball.m_prevPos.m_y)*m_renderAlpha;
+		int ballDrawX = (int)ballX - m_ballRadius - camX;
+		int ballDrawY = (int)ballY - m_ballRadius - camY;
+		drawImage(img_ball, ballDrawX, ballDrawY);
+	}
 
 	frameDone();
 }
 
+void GameLogic::updateCamera()
+{
+	// the camera follows the player's ball, from where it's being drawn
+	Ball &ball = m_balls[0];
+	double ballX = ball.m_prevPos.m_x + (ball.m_pos.m_x - ball.m_prevPos.m_x)*m_renderAlpha;
+	double ballY = ball.m_prevPos.m_y + (ball.m_pos.m_y - ball.m_prevPos.m_y)*m_renderAlpha;
+	getCamera(ballX, ballY, m_cameraX, m_cameraY);
+}
+
+void GameLogic::getCamera(double x, double y, int &outX, int &outY)
+{
+	// where the camera goes to have (x,y) in the middle of the screen.
+	// Except it never shows anything past the edges of the level, so near
+	// an edge the ball is off to that side of the screen instead.
+	outX = (int)x - SCREEN_WIDTH/2;
+	outY = (int)y - SCREEN_HEIGHT/2;
+	if ( outX > m_levelWidth - SCREEN_WIDTH ) outX = m_levelWidth - SCREEN_WIDTH;
+	if ( outY > m_levelHeight - SCREEN_HEIGHT ) outY = m_levelHeight - SCREEN_HEIGHT;
+	if ( outX < 0 ) outX = 0;
+	if ( outY < 0 ) outY = 0;
+}
+
+void GameLogic::updateLevelStream()
+{
+	// what has to be loaded before this step: the screen, which is what
+	// the player sees, and everywhere any of the balls can get to. With
+	// the one ball, the screen is most of that already. Note the camera 
+	// hasn't moved yet (see updateCamera), so we use where it'll be once
+	// it catches up with the ball.
+	int x1, y1;
+	getCamera(m_balls[0].m_pos.m_x, m_balls[0].m_pos.m_y, x1, y1);
+	int x2 = x1 + SCREEN_WIDTH;
+	int y2 = y1 + SCREEN_HEIGHT;
+	double reach = m_ballRadius + STREAM_LOOKAHEAD;
+	for ( int i=0 ; i<m_numBalls ; i++ )
+	{
+		Vector &pos = m_balls[i].m_pos;
+		if ( pos.m_x - reach < x1 ) x1 = (int)(pos.m_x - reach);
+		if ( pos.m_y - reach < y1 ) y1 = (int)(pos.m_y - reach);
+		if ( pos.m_x + reach > x2 ) x2 = (int)(pos.m_x + reach) + 1;
+		if ( pos.m_y + reach > y2 ) y2 = (int)(pos.m_y + reach) + 1;
+	}
+
+	// the stream only tells us when that brings in different chunks,
+	// which is just every so often as the ball goes along.
+	if ( m_levelStream.update(x1, y1, x2 - x1, y2 - y1) )
+	{
+		loadActiveChunks();
+	}
+}
+
+void GameLogic::loadActiveChunks()
+{
+	// swap out the blocks and pits for the ones in the chunks that are
+	// active now. The exit and the walls around the level are always there.
+	for ( int i=0 ; i<m_numBlocks ; i++ )
+	{
+		delete m_blocks[i];
+	}
+	m_numBlocks = 0;
+	m_numPits = 0;
+	m_collideBlocks.clear();
+	m_triggers.clear();
+	m_triggers.add(TRIGGER_EXIT, m_exitRect.x, m_exitRect.y, m_exitRect.w, m_exitRect.h);
+
+	for ( int i=0 ; i<m_levelStream.getNumActive() ; i++ )
+	{
+		LevelStream::Chunk *chunk = m_levelStream.getActive(i);
+		for ( int b=0 ; b<chunk->m_numBlocks ; b++ )
+		{
+			SDL_Rect &rc = chunk->m_blocks[b];
+			addCollideRect(rc.x, rc.y, rc.w, rc.h);
+		}
+		for ( int p=0 ; p<chunk->m_numPits ; p++ )
+		{
+			SDL_Rect &rc = chunk->m_pits[p];
+			addPit(rc.x, rc.y, rc.w, rc.h);
+		}
+	}
+
+	// the grids only need to cover the active chunks. Their blocks and pits
+	// can hang over by up to a chunk on the right and the bottom.
+	int chunkSize = m_levelStream.m_chunkSize;
+	m_gridRect.x = (Sint16)(m_levelStream.m_needCol1*chunkSize);
+	m_gridRect.y = (Sint16)(m_levelStream.m_needRow1*chunkSize);
+	m_gridRect.w = (Uint16)((m_levelStream.m_needCol2 - m_levelStream.m_needCol1 + 2)*chunkSize);
+	m_gridRect.h = (Uint16)((m_levelStream.m_needRow2 - m_levelStream.m_needRow1 + 2)*chunkSize);
+	m_bCollideGridDirty = SDL_TRUE;
+	m_bTriggersDirty = SDL_TRUE;
+	m_bStaticRectsDirty = SDL_TRUE;
+}
+
 	//getPath returns a path appropriate to the platform.
 	//MacOS builds create a different folder structure than
 	//Windows or Palm for all resources
@@ -309,7 +996,8 @@ void GameLogic::init()
 
 	// load images
 	img_ball = loadImage(getPath("ball.png"));
-	img_pit = loadImage(getPath("pit.jpg"));
+	// the pit's a photo, which shows bands at 16 bits unless it's dithered
+	img_pit = loadImage(getPath("pit.jpg"), IMAGE_FORMAT_AUTO, SDL_TRUE);
 	img_exit = loadImage(getPath("exit.gif"));
 
 	// note the ball radius. We extract it from the image of the ball.
@@ -321,6 +1009,32 @@ void GameLogic::init()
 	m_gameLoseSound = loadSound(getPath("wawa.wav"));
 	m_gameWinSound = loadSound(getPath("tada.wav"));
 
+	// and now the level itself
+	initLevel();
+}
+
+void GameLogic::initLevel()
+{
+	// everything here is the physical level. None of it needs a screen
+	// or sound, so a replay can set the level up without them. It does
+	// need the ball radius to be set.
+
+	// if we were given a level file, that's the level. Otherwise (or if
+	// it can't be read) it's the one that's built in, below.
+	SDL_bool bStreamed = SDL_FALSE;
+	if ( m_levelFile != NULL && m_levelStream.open(getPath(m_levelFile)) )
+	{
+		bStreamed = SDL_TRUE;
+		m_levelWidth = m_levelStream.m_width;
+		m_levelHeight = m_levelStream.m_height;
+		m_startX = m_levelStream.m_startX;
+		m_startY = m_levelStream.m_startY;
+	}
+	m_gridRect.x = 0;
+	m_gridRect.y = 0;
+	m_gridRect.w = (Uint16)m_levelWidth;
+	m_gridRect.h = (Uint16)m_levelHeight;
+
 	// set up our collision segments. 
 	// start with the 4 segments that comprise the outer wall.
 	// see addColliderRect for an explanation of how we initalize collideWalls
@@ -333,30 +1047,36 @@ void GameLogic::init()
 	// so here are the x, y, w, and h values for the actual collideWall
 	int boundsX1 = m_ballRadius;
 	int boundsY1 = m_ballRadius;
-	int boundsX2 = SCREEN_WIDTH - m_ballRadius;
-	int boundsY2 = SCREEN_HEIGHT - m_ballRadius;
-	int boundsW = SCREEN_WIDTH - m_ballRadius*2;
-	int boundsH = SCREEN_HEIGHT - m_ballRadius*2;
+	int boundsX2 = m_levelWidth - m_ballRadius;
+	int boundsY2 = m_levelHeight - m_ballRadius;
+	int boundsW = m_levelWidth - m_ballRadius*2;
+	int boundsH = m_levelHeight - m_ballRadius*2;
 
 	// top wall. It runs across the top of the screen and points down
-	m_collideWalls[m_numCollideWalls]= new CollideWall();
-	m_collideWalls[m_numCollideWalls]->initHorizontal(boundsX1, boundsY1, boundsW, 1); 
-	m_numCollideWalls++;
+	m_collideWalls.addHorizontal(boundsX1, boundsY1, boundsW, 1);
 
 	// bottom wall. Runs across the bottom of the screen and points up
-	m_collideWalls[m_numCollideWalls]= new CollideWall();
-	m_collideWalls[m_numCollideWalls]->initHorizontal(boundsX1, boundsY2, boundsW, -1); 
-	m_numCollideWalls++;
+	m_collideWalls.addHorizontal(boundsX1, boundsY2, boundsW, -1);
 
 	// left wall. Runs across the left side oft he screen and points right
-	m_collideWalls[m_numCollideWalls]= new CollideWall();
-	m_collideWalls[m_numCollideWalls]->initVertical(boundsX1, boundsY1, boundsH, 1); 
-	m_numCollideWalls++;
+	m_collideWalls.addVertical(boundsX1, boundsY1, boundsH, 1);
 
 	// right wall. Runs across the right side oft he screen and points left
-	m_collideWalls[m_numCollideWalls]= new CollideWall();
-	m_collideWalls[m_numCollideWalls]->initVertical(boundsX2, boundsY1, boundsH, -1); 
-	m_numCollideWalls++;
+	m_collideWalls.addVertical(boundsX2, boundsY1, boundsH, -1);
+
+	if ( bStreamed )
+	{
+		// the rest of a streamed level comes in a chunk at a time. Once the
+		// balls are at the start, we load what's around them (and the exit
+		// goes in with the pits, see loadActiveChunks).
+		m_exitRect = m_levelStream.m_exitRect;
+		m_lastTicks = SDL_GetTicks();
+		m_stepAccumulator = 0.0;
+		reset();
+		updateLevelStream();
+		updateCamera();
+		return;
+	}
 
 	// now, add the collide rects. These were carefully crafted by great
 	// artisans to provide maximum enjoyability in gameplay. Or, perhaps they
@@ -379,18 +1099,39 @@ void GameLogic::init()
 	m_exitRect.y = 438;
 	m_exitRect.w = 42;
 	m_exitRect.h = 42;
+	m_triggers.add(TRIGGER_EXIT, m_exitRect.x, m_exitRect.y, m_exitRect.w, m_exitRect.h);
+
+	// all the walls are in. Index them for the broadphase. Same
+	// goes for the pits and the exit.
+	buildCollideGrid();
+	buildTriggers();
 
 	// initalize m_lastTicks. Just start it off at the 
 	// current getTicks value.
 	m_lastTicks = SDL_GetTicks();
+	m_stepAccumulator = 0.0;
 
 	// set up for a game
 	reset();
 
 }
 
+// which level initLevel set up, for the top of a recording, and for
+// checking a replay is on the same one. The level file's hash, or 0 if
+// it's the built in level (see InputLog).
+Uint32 GameLogic::getLevelHash()
+{
+	return m_levelStream.isOpen() ? m_levelStream.m_hash : 0;
+}
+
 void GameLogic::addCollideRect(int x, int y, int width, int height)
 {
+	if ( m_numBlocks >= MAX_BLOCKS )
+	{
+		printf("Too many blocks (%d)\n", m_numBlocks);
+		return;
+	}
+
 	// first off, we add the rect to our list of blocks. We instance a new SDL_rect
 	// for the purpose, then store it.
 	SDL_Rect *newRect = new SDL_Rect();
@@ -401,41 +1142,43 @@ void GameLogic::addCollideRect(int x, int y, int width, int height)
 	m_blocks[m_numBlocks] = newRect;
 	m_numBlocks++;
 
-	// we don't want to do complex calculations to figure out of any part
-	// of a circle hit a collider wall. So instead of working out how to 
-	// do that, we outset the rect by the radius of the ball. That way, all we
-	// have to do is check collisioning on the center of the ball. So we start
-	// by outsettingthe rect.
-	x -= m_ballRadius;
-	y -= m_ballRadius;
-	width += m_ballRadius*2;
-	height += m_ballRadius*2;
-
-	// now make 4 collide walls out of this rect. Each collideWall 
-	// needs to know what direction it's facing. That's the "push"
-	// value (see collide.cpp for more info). The push value is -1 or 1.
-	// Its sign is in the direction that the collideWall faces. So if a
-	// collide wall is facing up, the push will be -1 (because y negative is up)
-
-	// the left wall. It runs vertical, and points left 
-	m_collideWalls[m_numCollideWalls]= new CollideWall();
-	m_collideWalls[m_numCollideWalls]->initVertical(x, y, height, -1); 
-	m_numCollideWalls++;
-
-	// the right wall. It runs vertical, and points right 
-	m_collideWalls[m_numCollideWalls]= new CollideWall();
-	m_collideWalls[m_numCollideWalls]->initVertical(x+width-1, y, height, 1); 
-	m_numCollideWalls++;
-
-	// the top wall. It runs horizontal, and points up
-	m_collideWalls[m_numCollideWalls]= new CollideWall();
-	m_collideWalls[m_numCollideWalls]->initHorizontal(x, y, width, -1); 
-	m_numCollideWalls++;
-
-	// the bottom wall. It runs horizontal, and points down
-	m_collideWalls[m_numCollideWalls]= new CollideWall();
-	m_collideWalls[m_numCollideWalls]->initHorizontal(x, y+height-1, width, 1); 
-	m_numCollideWalls++;
+	// and then as a collide block. We used to outset the rect by the
+	// radius of the ball and make 4 collide walls out of it, so we'd only
+	// have to check collisioning on the center of the ball. The block does
+	// the same thing, but with the corners rounded off the way the ball
+	// really is, and in one piece (see CollideBlockSet in collision.h).
+	m_collideBlocks.add(x, y, width, height);
+
+	// the collide grid no longer knows about all our blocks, and
+	// neither do the graphics
+	m_bCollideGridDirty = SDL_TRUE;
+	m_bStaticRectsDirty = SDL_TRUE;
+}
+
+void GameLogic::setLevelFile(const char *fileName)
+{
+	// initLevel loads the level from this file, instead of using the
+	// built in one. See levelstream.h for what goes in it.
+	m_levelFile = fileName;
+}
+
+void GameLogic::buildCollideGrid()
+{
+	// index all the collide walls over the playfield. This is done
+	// once the level is set up, and again any time a wall is added after that.
+	// That's over the whole playfield, or in a streamed level, the part
+	// of it that's loaded.
+	m_collideGrid.build(m_collideWalls, m_gridRect.x, m_gridRect.y, m_gridRect.w, m_gridRect.h);
+	m_collideBlocks.build(m_gridRect.x, m_gridRect.y, m_gridRect.w, m_gridRect.h, m_ballRadius);
+	m_bCollideGridDirty = SDL_FALSE;
+}
+
+void GameLogic::buildTriggers()
+{
+	// index the pits and the exit over the playfield. Like the collide
+	// grid, this is done once the level is set up.
+	m_triggers.build(m_gridRect.x, m_gridRect.y, m_gridRect.w, m_gridRect.h);
+	m_bTriggersDirty = SDL_FALSE;
 }
 
 void GameLogic::addPit(int x, int y, int width, int height)
@@ -449,21 +1192,23 @@ void GameLogic::addPit(int x, int y, int width, int height)
 	// note the actuall collision area of the pit, and the visible portion 
 	// of the pit. 
 
+	if ( m_numPits >= MAX_PITS )
+	{
+		printf("Too many pits (%d)\n", m_numPits);
+		return;
+	}
+
 	// first, note the visible portion. This is simply the sent-in values
-	SDL_Rect *newRect = new SDL_Rect();
-	newRect->x = (Sint16)x;
-	newRect->y = (Sint16)y;
-	newRect->w = (Sint16)width;
-	newRect->h = (Sint16)height;
-	m_pitDisplays[m_numPits] = newRect;
+	SDL_Rect &display = m_pitDisplays[m_numPits];
+	display.x = (Sint16)x;
+	display.y = (Sint16)y;
+	display.w = (Uint16)width;
+	display.h = (Uint16)height;
 
-	// now make note of the collision area of this pit
-	newRect = new SDL_Rect();
-	newRect->x = (Sint16)(x - m_ballRadius/2);
-	newRect->y = (Sint16)(y - m_ballRadius/2);
-	newRect->w = (Sint16)(width + m_ballRadius/2);
-	newRect->h = (Sint16)(height + m_ballRadius/2);
-	m_pits[m_numPits] = newRect;
+	// now make note of the collision area of this pit. It's a trigger, 
+	// so it goes in with the other triggers.
+	m_triggers.add(TRIGGER_PIT, x - m_ballRadius/2, y - m_ballRadius/2, width + m_ballRadius/2, height + m_ballRadius/2);
+	m_bTriggersDirty = SDL_TRUE;
 
 	// update the number of pits
 	m_numPits++;
@@ -471,9 +1216,224 @@ void GameLogic::addPit(int x, int y, int width, int height)
 
 void GameLogic::reset()
 {
-	// start the ball in the upper corner
-	// with no velocity
-	m_ballPos.setXY(20, 20);
-	m_ballVel.setXY(0, 0);
+	// put all the balls back at the start
+	for ( int i=0 ; i<m_numBalls ; i++ )
+	{
+		resetBall(i);
+	}
+	m_renderAlpha = 1.0;
+	m_bAsleep = SDL_FALSE;
+	m_bNeedsDraw = SDL_TRUE;
+}
+
+void GameLogic::updateRest(Ball &ball)
+{
+	// called after every step. A ball that's resting doesn't have to be 
+	// perfectly still: one pinned against a wall by the tilt keeps falling
+	// in to the wall and bouncing a hair's width back out. So rather than
+	// look for no movement, we look for a ball that stays near one spot
+	// and never picks up any real speed. If it does that for 
+	// SLEEP_AFTER_MS, it goes to sleep.
+	if ( ball.m_bAsleep ) return;
+
+	double dx = ball.m_pos.m_x - ball.m_restPos.m_x;
+	double dy = ball.m_pos.m_y - ball.m_restPos.m_y;
+	double speedSq = ball.m_vel.getLengthSq();
+	if ( dx*dx + dy*dy > SLEEP_DISTANCE*SLEEP_DISTANCE || speedSq > SLEEP_VELOCITY*SLEEP_VELOCITY )
+	{
+		// it's going somewhere. Start over from here.
+		ball.m_restPos.set(ball.m_pos);
+		ball.m_restMs = 0.0;
+		return;
+	}
+
+	ball.m_restMs += m_stepMs;
+	if ( ball.m_restMs >= SLEEP_AFTER_MS )
+	{
+		// stop it dead, so it wakes up from a standstill, and
+		// draw it right where it is
+		ball.m_bAsleep = SDL_TRUE;
+		ball.m_vel.setXY(0, 0);
+		ball.m_prevPos.set(ball.m_pos);
+	}
 }
 
+void GameLogic::wake()
+{
+	// wake every ball, and start the game back up if it was asleep. The 
+	// time that went by while we slept doesn't count.
+	for ( int i=0 ; i<m_numBalls ; i++ )
+	{
+		Ball &ball = m_balls[i];
+		if ( !ball.m_bAsleep ) continue;
+		ball.m_bAsleep = SDL_FALSE;
+		ball.m_restPos.set(ball.m_pos);
+		ball.m_restMs = 0.0;
+	}
+	if ( m_bAsleep )
+	{
+		m_bAsleep = SDL_FALSE;
+		m_stepAccumulator = 0.0;
+	}
+	watchAccelerometer(0.0);
+	m_bWatchingTilt = SDL_FALSE;
+}
+
+void GameLogic::resetBall(int index)
+{
+	Ball &ball = m_balls[index];
+	if ( index == 0 )
+	{
+		// start the ball in the upper corner (or wherever the
+		// level says) with no velocity
+		ball.m_pos.setXY(m_startX, m_startY);
+		ball.m_vel.setXY(0, 0);
+	}
+	else
+	{
+		// the extra balls of a stress scene get scattered along the
+		// top of the level, moving off in different directions. We use
+		// our own little random number generator (the same one as the C
+		// library's rand() in the C standard) so a stress scene plays out
+		// exactly the same way every time, on every platform. A level file
+		// can be too narrow to leave 20 pixels on each side, and then they
+		// all just start in the middle.
+		m_randomSeed = m_randomSeed*1103515245 + 12345;
+		int across = m_levelWidth - 40;
+		double x = m_levelWidth/2.0;
+		if ( across > 0 )
+		{
+			x = 20 + (double)((m_randomSeed>>16)%across);
+		}
+		m_randomSeed = m_randomSeed*1103515245 + 12345;
+		double angle = (double)((m_randomSeed>>16)%628)/100.0;
+		ball.m_pos.setXY(x, m_startY);
+		ball.m_vel.setRTheta(100, angle);
+	}
+
+	// and don't draw it sliding over from where it was
+	ball.m_prevPos.set(ball.m_pos);
+	ball.m_events = 0;
+	ball.m_wallsTested = 0;
+
+	// a ball that's just been put somewhere new is awake
+	ball.m_restPos.set(ball.m_pos);
+	ball.m_restMs = 0.0;
+	ball.m_bAsleep = SDL_FALSE;
+}
+
+void GameLogic::setNumBalls(int numBalls, int numThreads)
+{
+	// one ball is the normal game. More than that makes a stress scene.
+	if ( numBalls < 1 ) numBalls = 1;
+	if ( numBalls > MAX_BALLS ) numBalls = MAX_BALLS;
+
+	delete [] m_balls;
+	m_balls = new Ball[numBalls];
+	m_numBalls = numBalls;
+
+	delete [] m_ballPairs;
+	m_maxBallPairs = numBalls*MAX_PAIRS_PER_BALL;
+	m_ballPairs = new int[m_maxBallPairs*2];
+	m_randomSeed = 1;
+	reset();
+
+	// there's no point in threads for the real game
+	m_threadPool.start(numBalls > 1 ? numThreads : 1);
+}
+
+
+void GameLogic::setRecordFile(const char *fileName)
+{
+	// run() starts the recording once the level is set up. 
+	// See inputlog.h for what gets saved
+	m_recordFile = fileName;
+}
+
+int GameLogic::replay(const char *fileName, int numThreads)
+{
+	// plays back a game saved with setRecordFile, as fast as we can,
+	// without a screen or sound. Nothing but the physics. Returns 0 if
+	// it went ok, 1 if the log couldn't be read, or was recorded on a
+	// different level.
+	if ( !m_inputLog.load(fileName) )
+	{
+		return 1;
+	}
+	m_bHeadless = SDL_TRUE;
+
+	// set everything up the way it was when the game was recorded
+	if ( m_inputLog.m_numBalls > 1 )
+	{
+		setNumBalls(m_inputLog.m_numBalls, numThreads);
+	}
+	m_bFixedStep = (m_inputLog.m_flags & InputLog::FLAG_FIXED_STEP) ? SDL_TRUE : SDL_FALSE;
+	m_bBallCollisions = (m_inputLog.m_flags & InputLog::FLAG_BALL_COLLISIONS) ? SDL_TRUE : SDL_FALSE;
+	m_ballRadius = m_inputLog.m_ballRadius;
+	updateAccelerometer(ACCELEROMETER_X, 0);
+	updateAccelerometer(ACCELEROMETER_Y, 0);
+	updateAccelerometer(ACCELEROMETER_Z, 0);
+	initLevel();
+
+	// the same inputs on a different level is a different game, and the
+	// checksum would mean nothing. -level has to match the recording.
+	if ( getLevelHash() != m_inputLog.m_level )
+	{
+		printf("%s was recorded on a different level than this one. Replay it with the same -level it was played with\n", fileName);
+		return 1;
+	}
+
+	// As we go, we keep a checksum of everywhere the player's ball has been
+	// (it's an FNV-1a hash, of the bytes of the position). If a change to the
+	// physics moves the ball even a tiny bit, this comes out different.
+	Uint32 checksum = 2166136261u;
+	int numTicks = 0;
+	int type, axis, value;
+	Uint32 startTicks = SDL_GetTicks();
+	while ( m_inputLog.next(type, axis, value) )
+	{
+		if ( type == InputLog::RECORD_AXIS )
+		{
+			updateAccelerometer(axis, value);
+			continue;
+		}
+
+		tick(value);
+		numTicks++;
+
+		const Uint8 *bytes = (const Uint8 *)&m_balls[0].m_pos;
+		for ( int i=0 ; i<(int)sizeof(m_balls[0].m_pos) ; i++ )
+		{
+			checksum = (checksum ^ bytes[i])*16777619u;
+		}
+	}
+	Uint32 elapsed = SDL_GetTicks() - startTicks;
+
+	// and every other ball's last position, for the stress scenes
+	for ( int b=1 ; b<m_numBalls ; b++ )
+	{
+		const Uint8 *bytes = (const Uint8 *)&m_balls[b].m_pos;
+		for ( int i=0 ; i<(int)sizeof(m_balls[b].m_pos) ; i++ )
+		{
+			checksum = (checksum ^ bytes[i])*16777619u;
+		}
+	}
+
+	printf("Replayed %d ticks (%u physics steps) with %d balls in %u ms\n", numTicks, m_totalSteps, m_numBalls, elapsed);
+	if ( numTicks > 0 )
+	{
+		printf("%.1f us per tick\n", (double)elapsed*1000.0/(double)numTicks);
+	}
+	if ( m_totalSteps > 0 )
+	{
+		printf("Walls tested per step: %.2f\n", (double)m_totalWallsTested/(double)m_totalSteps);
+	}
+	printf("Ticks spent asleep: %u\n", m_totalSleepTicks);
+	if ( m_levelStream.isOpen() )
+	{
+		printf("Level chunks loaded: %u, waited for: %u\n", m_levelStream.m_numLoads, m_levelStream.m_numWaits);
+	}
+	printf("Ball ended at %.17g, %.17g\n", m_balls[0].m_pos.m_x, m_balls[0].m_pos.m_y);
+	printf("Checksum: %08x\n", checksum);
+	return 0;
+}
@@ -1,10 +1,37 @@
 #ifndef __GAMELOGIC__
+#define __GAMELOGIC__
 
-#include "SDL_Mixer.h"
+#include "SDL_mixer.h"
 #include "geometry.h"
 #include "graphics.h"
+#include "collision.h"
+#include "trigger.h"
+#include "inputlog.h"
+#include "threadpool.h"
+#include "levelstream.h"
 
-class CollideWall;
+// the physics state of one ball. The regular game has just the one, 
+// but stress scenes can have thousands.
+struct Ball
+{
+	// the things that can happen to a ball during a step. These get
+	// or'd together in m_events
+	static const int HIT_WALL = 1;
+	static const int IN_PIT = 2;
+	static const int AT_EXIT = 4;
+
+	Vector m_pos; // current location of the ball's center
+	Vector m_vel; // current velocity of the ball, in pixels per second
+	Vector m_prevPos; // where the ball was before the last physics step
+	int m_events; // what happened to the ball on the last step
+	int m_wallsTested; // how many walls and blocks it was tested against on the last step
+
+	// resting. A ball that stays close to m_restPos for long enough goes to
+	// sleep, and isn't moved until it's woken up. See GameLogic::updateRest
+	Vector m_restPos;
+	double m_restMs;
+	SDL_bool m_bAsleep;
+};
 
 // The main game logic class. As with all the classes
 // in this sample app, the bulk of the comments are in the cpp code. 
@@ -17,10 +44,18 @@ public:
 	// we allocate each as needed, but we'd rather not 
 	// implement a growing array system just to avoid having
 	// a maximum. The same idea applies to the visible blocks
-	// and pits.
-	static const int MAX_COLLIDEWALLS = 256;
-	static const int MAX_BLOCKS = 256;
-	static const int MAX_PITS = 256;
+	// and pits, except those have to have room for everything in the
+	// chunks a streamed level can have loaded at once.
+	static const int MAX_COLLIDEWALLS = CollideWallSet::MAX_WALLS;
+	static const int MAX_BLOCKS = LevelStream::MAX_ACTIVE_BLOCKS;
+	static const int MAX_PITS = LevelStream::MAX_ACTIVE_PITS;
+
+	// the kinds of trigger volumes in a level. See checkTriggers
+	static const int TRIGGER_PIT = 0;
+	static const int TRIGGER_EXIT = 1;
+
+	// the most triggers we care about the ball being in at once
+	static const int MAX_TRIGGER_HITS = 8;
 
 	// acceleration due to gravity. This is in 
 	// pixels per second per second. Same as any other 
@@ -33,18 +68,81 @@ public:
 	static const int GRAVITY_ACC_PPSPS_INT = 300;
 	static const int MINIMUM_REBOUND_VELOCITY_INT = 5;
 
+	// in fixed step mode, the physics runs this many times a second no
+	// matter how fast we draw. MAX_SUBSTEPS is the most steps we'll take
+	// in one frame; it's enough to cover the 100ms cap on a frame's time.
+	static const int FIXED_STEP_HZ = 120;
+	static const int MAX_SUBSTEPS = 12;
+
+	// putting the balls to sleep. A ball that stays within SLEEP_DISTANCE
+	// pixels of the same spot, never going faster than SLEEP_VELOCITY, for
+	// SLEEP_AFTER_MS falls asleep. Once they're all asleep, the game stops 
+	// stepping the physics and drawing until the tilt changes by more than
+	// WAKE_TILT_PERCENT of 1g. Meanwhile the main loop checks in every
+	// ASLEEP_DELAY_MS instead of every 10ms.
+	static const int SLEEP_DISTANCE = 1;
+	static const int SLEEP_VELOCITY = 20;
+	static const int SLEEP_AFTER_MS = 500;
+	static const int WAKE_TILT_PERCENT = 5;
+	static const int ASLEEP_DELAY_MS = 40;
+
+	// the most walls the ball can bounce off of in a single physics step
+	static const int MAX_BOUNCES = 4;
+
+	// the most balls we'll simulate at once, and how many balls
+	// the thread pool hands out at a time
+	static const int MAX_BALLS = 65536;
+	static const int BALLS_PER_CHUNK = 64;
+
+	// room for this many touching pairs per ball, on average. Balls
+	// packed as tight as they can go only touch 6 others, and each pair
+	// is only counted once, so this is plenty.
+	static const int MAX_PAIRS_PER_BALL = 4;
+
+	// how many times we go over the touching pairs each step. See collideBalls
+	static const int BALL_SOLVER_ITERATIONS = 4;
+
+	// in a level that's streamed in from a file, how far past a ball (in
+	// pixels) the level has to be loaded before each step. It's well more
+	// than the ball can go in a step. See updateLevelStream
+	static const int STREAM_LOOKAHEAD = 128;
+
 	// member functions. See the cpp file for detailed comments
 	GameLogic();
 	virtual ~GameLogic();
 
 	void run();
+	void printStats();
 	void init();
+	void initLevel();
+	Uint32 getLevelHash();
 	void eventloop();
 	void tick();
+	void tick(int ms);
+	void step(double ms);
+	void stepBalls(int begin, int end);
+	void stepBall(Ball &ball);
+	void collideBalls();
+	void moveBallTo(Ball &ball, Vector &target);
+	void checkTriggers(Ball &ball);
+	void updateRest(Ball &ball);
+	void wake();
+	SDL_bool sweepTriggers(Ball &ball, Vector &start, Vector &end);
 	void draw();
+	void updateCamera();
+	void getCamera(double x, double y, int &outX, int &outY);
+	void updateLevelStream();
+	void loadActiveChunks();
 	void addCollideRect(int x, int y, int width, int height);
 	void addPit(int x, int y, int width, int height);
+	void buildCollideGrid();
+	void buildTriggers();
 	void reset();
+	void resetBall(int index);
+	void setNumBalls(int numBalls, int numThreads);
+	void setRecordFile(const char *fileName);
+	void setLevelFile(const char *fileName);
+	int replay(const char *fileName, int numThreads);
 	const char *getPath(const char *file);
 
 
@@ -66,30 +164,117 @@ public:
 	Image *img_exit; // the exit
 	Image *img_pit;  // the pit
 
-	// ball physics values
-	Vector m_ballPos; // current location of the ball's center
-	Vector m_ballVel; // current velocity of the ball, in pixels per second
+	// the balls. m_balls[0] is the player's ball
+	Ball *m_balls;
+	int m_numBalls;
+	Uint32 m_randomSeed; // for scattering the extra balls
 
-	// collision segments
-	CollideWall *m_collideWalls[MAX_COLLIDEWALLS];
-	int m_numCollideWalls;
+	// spreads the balls out over the CPUs
+	ThreadPool m_threadPool;
 
-	// visible rects
+	// ball vs ball collision. m_ballPairs holds the touching
+	// pairs found on the last step, two indexes per pair
+	SDL_bool m_bBallCollisions;
+	BallHash m_ballHash;
+	int *m_ballPairs;
+	int m_maxBallPairs;
+	int m_ballPairsFound;
+
+	// what every ball needs to know for the current step. Set
+	// by step() before the balls are moved.
+	double m_stepMs;
+	double m_stepAccX;
+	double m_stepAccY;
+
+	// collision segments. These are just the edges of the level now;
+	// the blocks in it are in m_collideBlocks.
+	CollideWallSet m_collideWalls;
+	CollideBlockSet m_collideBlocks;
+
+	// broadphase for the collision segments. It's rebuilt whenever
+	// the walls or blocks change, which is flagged by m_bCollideGridDirty.
+	// (the blocks keep their own grid, which gets rebuilt at the same time)
+	CollideGrid m_collideGrid;
+	SDL_bool m_bCollideGridDirty;
+
+	// collision stats. The number of walls and blocks that went through
+	// the collision test on the last step, and running totals so we can
+	// get an average over the whole run. These count physics steps (see
+	// step), not ticks, and with the fixed step a tick can take a few.
+	int m_wallsTested;
+	Uint32 m_totalWallsTested;
+	Uint32 m_totalSteps;
+
+	// visible rects. They're drawn as static rects (see addStaticRect in
+	// graphics.h), which get handed over again when m_bStaticRectsDirty is set.
 	SDL_Rect *m_blocks[MAX_BLOCKS];
 	int m_numBlocks;
+	SDL_bool m_bStaticRectsDirty;
 
 	// deadly pits of deadly deadliness
-	// also they are deadly
-	SDL_Rect *m_pits[MAX_PITS]; // the physical location of the pit
-	SDL_Rect *m_pitDisplays[MAX_PITS]; // the visible portion of the pit
+	// also they are deadly. The physical location of each pit
+	// is a trigger in m_triggers; this is the visible portion.
+	SDL_Rect m_pitDisplays[MAX_PITS];
 	int m_numPits;
 
 	// the exit. If they hit this, they win
 	SDL_Rect m_exitRect;
 
+	// the size of the level, and where the ball starts. The built in level
+	// is the size of the screen. One from a file can be a lot bigger, and 
+	// then m_levelStream loads just the part of it around the ball, and the
+	// camera follows the ball around. (m_cameraX, m_cameraY) is the top left
+	// of the screen, in the level.
+	int m_levelWidth;
+	int m_levelHeight;
+	int m_startX;
+	int m_startY;
+	int m_cameraX;
+	int m_cameraY;
+	const char *m_levelFile;
+	LevelStream m_levelStream;
+
+	// the part of the level the collide grid and the trigger grid cover.
+	// That's the whole level, unless it's streamed in.
+	SDL_Rect m_gridRect;
+
+	// the pits and the exit, indexed so checking the ball against them
+	// only looks at the ones nearby. Rebuilt when m_bTriggersDirty is set.
+	TriggerSet m_triggers;
+	SDL_bool m_bTriggersDirty;
+
 	// time management
 	int m_lastTicks;
 
+	// sleeping. m_bAsleep is set when every ball is asleep, and then tick()
+	// doesn't do anything until the accelerometer moves. m_bWatchingTilt is
+	// set while any ball is asleep, and the accelerometer is being watched
+	// for the tilt that wakes them. m_bNeedsDraw is set by tick() whenever
+	// there's something new to draw. m_totalSleepTicks counts the ticks 
+	// we skipped.
+	SDL_bool m_bAsleep;
+	SDL_bool m_bWatchingTilt;
+	SDL_bool m_bNeedsDraw;
+	Uint32 m_totalSleepTicks;
+
+	// input recording and playback. If m_recordFile is set, run() records
+	// the game in to it. m_bHeadless means there's no screen or sound, 
+	// which is how replay() runs.
+	InputLog m_inputLog;
+	const char *m_recordFile;
+	SDL_bool m_bHeadless;
+
+	// if run() prints how the physics and drawing went when it's done
+	SDL_bool m_bPrintStats;
+
+	// fixed step physics. When m_bFixedStep is on, tick() runs step() in 
+	// slices of m_fixedStepMs, carrying left over time in m_stepAccumulator.
+	// m_renderAlpha is how far between a ball's m_prevPos and m_pos to draw it.
+	SDL_bool m_bFixedStep;
+	double m_fixedStepMs;
+	double m_stepAccumulator;
+	double m_renderAlpha;
+
 	// the sound effect we'll be using
 	Mix_Chunk *m_wallHitSound;
 
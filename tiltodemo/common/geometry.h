@@ -2,56 +2,299 @@
 #define __GEOMETRY__
 
 #include "SDL.h"
+#include "globals.h"
+#include <math.h>
 
 
-class Vector
+// A 16.16 fixed point number: a 32 bit int, where the low 16 bits are
+// the fraction. So 1.0 is 65536, and 0.5 is 32768. It goes from -32768 up
+// to just under 32768, in steps of 1/65536th, which is plenty for pixels.
+// 
+// The point of it is that it's all int math. The device builds use 
+// -mfloat-abi=softfp, and the Pixi's VFP is no speed demon, so doubles aren't
+// free. Int math also comes out exactly the same on every machine, which
+// doubles don't always. Vector, applyPPSVel, ptInRect and the collide walls
+// can all be used with a Fixed in place of a double.
+//
+// Multiplies and divides go through 64 bits on the way, so they don't
+// overflow part way. Anything that ends up outside of the range above wraps
+// around, so keep the numbers pixel sized.
+class Fixed
 {
 public:
-	Vector(){}
-	void set(Vector &in);
-	void setXY(double x, double y);
-	SDL_bool equals(Vector &in);
+	static const int FRACTION_BITS = 16;
+	static const Sint32 ONE = 1 << FRACTION_BITS;
+
+	Fixed() {}
+	Fixed(int i) { m_raw = (Sint32)(i*ONE); }
+	Fixed(double d) { m_raw = (Sint32)(d*ONE + (d >= 0.0 ? 0.5 : -0.5)); } // rounds to the nearest step
+
+	static Fixed fromRaw(Sint32 raw) { Fixed f; f.m_raw = raw; return f; }
+	double toDouble() const { return (double)m_raw/ONE; }
+	int toInt() const { return m_raw >> FRACTION_BITS; } // rounds down, like floor
+
+	Fixed operator-() const { return fromRaw(-m_raw); }
+	Fixed &operator+=(Fixed b) { m_raw += b.m_raw; return *this; }
+	Fixed &operator-=(Fixed b) { m_raw -= b.m_raw; return *this; }
+	Fixed &operator*=(Fixed b) { m_raw = (Sint32)(((Sint64)m_raw*b.m_raw) >> FRACTION_BITS); return *this; }
+	Fixed &operator/=(Fixed b) { m_raw = (Sint32)((((Sint64)m_raw) << FRACTION_BITS)/b.m_raw); return *this; }
+
+	// data
+	Sint32 m_raw;
+};
+
+inline Fixed operator+(Fixed a, Fixed b) { return a += b; }
+inline Fixed operator-(Fixed a, Fixed b) { return a -= b; }
+inline Fixed operator*(Fixed a, Fixed b) { return a *= b; }
+inline Fixed operator/(Fixed a, Fixed b) { return a /= b; }
+inline bool operator==(Fixed a, Fixed b) { return a.m_raw == b.m_raw; }
+inline bool operator!=(Fixed a, Fixed b) { return a.m_raw != b.m_raw; }
+inline bool operator<(Fixed a, Fixed b) { return a.m_raw < b.m_raw; }
+inline bool operator<=(Fixed a, Fixed b) { return a.m_raw <= b.m_raw; }
+inline bool operator>(Fixed a, Fixed b) { return a.m_raw > b.m_raw; }
+inline bool operator>=(Fixed a, Fixed b) { return a.m_raw >= b.m_raw; }
+
+// for the math library functions, which only take doubles
+inline double toDouble(double d) { return d; }
+inline double toDouble(Fixed f) { return f.toDouble(); }
+
+// Quick trig, for when the math library is too slow. fastSinCos gets the
+// sin and cos of an angle together, for less than one of them costs from
+// the library. fastAtan2 is atan2. fastSinCos is never more than 2e-9 off
+// the real thing, and fastAtan2 never more than 3e-9; see geometry.cpp for
+// the details.
+void fastSinCos(double theta, double &outSin, double &outCos);
+double fastAtan2(double y, double x);
+
+// the trig the vectors use. USE_FAST_TRIG in globals.h picks which. 
+// Asking for the sin and cos of the same angle together also lets gcc
+// turn the library calls in to a single sincos.
+inline void vectorSinCos(double theta, double &outSin, double &outCos)
+{
+#if USE_FAST_TRIG
+	fastSinCos(theta, outSin, outCos);
+#else
+	outSin = sin(theta);
+	outCos = cos(theta);
+#endif
+}
+
+inline double vectorAtan2(double y, double x)
+{
+#if USE_FAST_TRIG
+	return fastAtan2(y, x);
+#else
+	return atan2(y, x);
+#endif
+}
+
+// A 2d vector, of doubles (Vector) or of Fixed (FixedVector). It's all
+// in here, so the compiler can inline it in to the physics. Anything that
+// doesn't change the vector is const, and takes what it reads as const, 
+// so they can be used on anything. 
+template <typename T>
+class BasicVector
+{
+public:
+	BasicVector() {}
+	BasicVector(T x, T y) : m_x(x), m_y(y) {}
+
+	void set(const BasicVector &in) { m_x = in.m_x; m_y = in.m_y; }
+	void setXY(T x, T y) { m_x = x; m_y = y; }
+	SDL_bool equals(const BasicVector &in) const { return (m_x == in.m_x && m_y == in.m_y) ? SDL_TRUE : SDL_FALSE; }
 
 	// set with polar coordinates. note -- Theta is in radians
-	void setRTheta(double r, double theta);
+	void setRTheta(T r, double theta);
 
 	// get the length (r) of the vector
-	double getLength();
-	double getLengthSq(); // for optimized distance checks
+	T getLength() const;
+	T getLengthSq() const { return m_x*m_x + m_y*m_y; } // for optimized distance checks. Careful, a Fixed overflows past 181 pixels
+	T dot(const BasicVector &in) const { return m_x*in.m_x + m_y*in.m_y; }
 
 	// returns the radiuns of the vector. If the vector's length is
 	// 0, it returns 0
-	double getAngle();
-	void addVector(Vector &in);
-	void subtractVector(Vector &in);
+	double getAngle() const;
+	void addVector(const BasicVector &in) { m_x += in.m_x; m_y += in.m_y; }
+	void subtractVector(const BasicVector &in) { m_x -= in.m_x; m_y -= in.m_y; }
 	
 	// adjusts the length of the vector by the scalar
-	void scalarMultiply(double scalar);
-	void scalarDivide(double scalar);
+	void scalarMultiply(T scalar) { m_x *= scalar; m_y *= scalar; }
+	void scalarDivide(T scalar) { m_x /= scalar; m_y /= scalar; }
 	
 	// rotates the point around the origin be the given number of radiuns
 	void rotate(double theta);
 	
 	// makes the length of the vector 1.0 without changing the angle
-	void normalize();
+	void normalize() { scalarDivide(getLength()); }
 	
 	// changes the length of the vector to the desired length
 	// this is safer than calling normalize then multiplying, cause
 	// it'll have less approximation errors in the angle
-	void setLength(double fixNewLength);
+	void setLength(T newLength);
+
+	// the same things as operators, for when it reads better
+	BasicVector &operator+=(const BasicVector &in) { addVector(in); return *this; }
+	BasicVector &operator-=(const BasicVector &in) { subtractVector(in); return *this; }
+	BasicVector &operator*=(T scalar) { scalarMultiply(scalar); return *this; }
+	BasicVector &operator/=(T scalar) { scalarDivide(scalar); return *this; }
+	BasicVector operator+(const BasicVector &in) const { return BasicVector(m_x + in.m_x, m_y + in.m_y); }
+	BasicVector operator-(const BasicVector &in) const { return BasicVector(m_x - in.m_x, m_y - in.m_y); }
+	BasicVector operator-() const { return BasicVector(-m_x, -m_y); }
+	BasicVector operator*(T scalar) const { return BasicVector(m_x*scalar, m_y*scalar); }
+	BasicVector operator/(T scalar) const { return BasicVector(m_x/scalar, m_y/scalar); }
+	bool operator==(const BasicVector &in) const { return m_x == in.m_x && m_y == in.m_y; }
+	bool operator!=(const BasicVector &in) const { return !(*this == in); }
 	
 	/******************************** CLASS DATA ******************************/
-	double m_x;
-	double m_y;
+	T m_x;
+	T m_y;
 };
 
-double applyPPSVel(double StartPos, double PPSVel, double milliseconds);
-void applyPPSVel(Vector &startPos, Vector &ppsVel, double milliseconds, Vector &outResult);
-SDL_bool ptInRect(int x, int y, SDL_Rect *rc);
+// the regular vector. Everything in the game uses this one.
+typedef BasicVector<double> Vector;
+
+// and one in fixed point
+typedef BasicVector<Fixed> FixedVector;
+
+template <typename T>
+inline void BasicVector<T>::setRTheta(T r, double theta)
+{
+	// remember trig class, boys and girls?
+	// x = r*cos(theta), y=r*sin(theta)
+	double sinTheta, cosTheta;
+	vectorSinCos(theta, sinTheta, cosTheta);
+	
+	m_x = r*cosTheta;
+	m_y = r*sinTheta;
+}
+
+template <typename T>
+inline T BasicVector<T>::getLength() const
+{
+	// done in doubles, since there's no fixed point sqrt. That also
+	// keeps a long FixedVector from overflowing on the way.
+	double x = toDouble(m_x);
+	double y = toDouble(m_y);
+	return sqrt(x*x + y*y);
+}
+
+template <typename T>
+inline double BasicVector<T>::getAngle() const
+{
+	if ( (m_x==0) && (m_y==0) )
+	{
+		return 0;
+	}
+
+	return vectorAtan2(toDouble(m_y), toDouble(m_x));
+}
+
+template <typename T>
+inline void BasicVector<T>::rotate(double angle)
+{
+	// Well documented formula: how to rotate a point around the origin:
+	// newX = x*cos(theta) - y*sin(theta)
+	// newY = x*sin(theta) + y*cos(theta)
+	double sinAngle, cosAngle;
+	vectorSinCos(angle, sinAngle, cosAngle);
+	double x = toDouble(m_x);
+	double y = toDouble(m_y);
+	double newX = x*cosAngle - y*sinAngle;
+	double newY = x*sinAngle + y*cosAngle;
+	
+	m_x = newX;
+	m_y = newY;
+}
+
+template <typename T>
+inline void BasicVector<T>::setLength(T newLength)
+{
+	T origLength = getLength();
+	if ( origLength == 0.0 )
+	{
+		setXY(0,0);
+		return;
+	}
+	scalarMultiply(newLength);
+	scalarDivide(origLength);
+}
+
+// this function applies a velocity in PIXELS PER SECOND to a postion, with a time
+// sent in in MILLISECONDS. It's IMPORTANT to note the discrepency in units. This
+// functionality comes up often enough that it warranted a spot here. 
+// The return value is the new location
+template <typename T>
+inline T applyPPSVel(T startPos, T PPSVel, T milliseconds)
+{
+	T movement = PPSVel*milliseconds;
+	movement = movement/(double)1000.0;
+	return startPos + movement;
+}
+
+// In fixed point, the velocity times the milliseconds can easily go past
+// 32768 (2000 pixels a second for 100ms does), so that part is done in 64 
+// bits. And while we're down there, we do the divide by 1000 too. 
+template <>
+inline Fixed applyPPSVel(Fixed startPos, Fixed PPSVel, Fixed milliseconds)
+{
+	Sint64 movement = ((Sint64)PPSVel.m_raw*milliseconds.m_raw)/((Sint64)1000*Fixed::ONE);
+	return startPos + Fixed::fromRaw((Sint32)movement);
+}
+
+// same as the other applyPPSVel, except this one uses vectors and an outResult
+template <typename T>
+inline void applyPPSVel(const BasicVector<T> &startPos, const BasicVector<T> &ppsVel, T milliseconds, BasicVector<T> &outResult)
+{
+	outResult.m_x = applyPPSVel(startPos.m_x, ppsVel.m_x, milliseconds);
+	outResult.m_y = applyPPSVel(startPos.m_y, ppsVel.m_y, milliseconds);
+}
+
+// fairly straightforward point in rect functionality
+template <typename T>
+inline SDL_bool ptInRect(T px, T py, T rectX, T rectY, T rectWidth, T rectHeight)
+{
+	if ( px < rectX ) return SDL_FALSE;
+	if ( px >= rectX+rectWidth ) return SDL_FALSE;
+	if ( py < rectY ) return SDL_FALSE;
+	if ( py >= rectY+rectHeight) return SDL_FALSE;
+	return SDL_TRUE;
+}
+
+template <typename T>
+inline SDL_bool ptInRect(T px, T py, const SDL_Rect *rc)
+{
+	return ptInRect<T>(px, py, rc->x, rc->y, rc->w, rc->h);
+}
+
+inline SDL_bool ptInRect(int x, int y, const SDL_Rect *rc)
+{
+	return ptInRect<double>(x, y, rc->x, rc->y, rc->w, rc->h);
+}
+
+/*** BATCH FUNCTIONS ***/
+// These do the same thing to a whole array of vectors at once. Each one is
+// a plain loop with nothing in it that stops the compiler from turning it
+// in to SIMD (-ftree-vectorize, which -O3 turns on), and the call only
+// happens once per array instead of once per vector. In and out can be the
+// same array. They're in geometry.cpp, for doubles and Fixed.
+
+// outResult[i] = startPos[i] moved by ppsVel[i] for the milliseconds.
+template <typename T>
+void applyPPSVel(const BasicVector<T> *startPos, const BasicVector<T> *ppsVel, T milliseconds, BasicVector<T> *outResult, int count);
+
+// vectors[i] += ppsAcc for the milliseconds. One acceleration for all of 
+// them, like gravity on the velocities of a pile of balls.
+template <typename T>
+void applyPPSVel(BasicVector<T> *vectors, const BasicVector<T> &ppsAcc, T milliseconds, int count);
+
+// rotates every vector around the origin by the same angle. The sin and
+// cos only get worked out the once, so this is the one to use for a pile
+// of sprites or balls that all turn together.
+template <typename T>
+void rotateMany(BasicVector<T> *vectors, int count, double theta);
 
 /*
 // geometric management functions.
-SDL_bool ptInRect(double px, double py, double rectX, double rectY, double rectWidth, double rectHeight);
 SDL_bool ptInTriangle(Vector &t1, Vector &t2, Vector &t3, Vector &p);
 SDL_bool sameSide(Vector &p1, Vector &p2, Vector &p3, Vector &p4);
 SDL_bool segmentsIntersect(Vector &p1, Vector &p2, Vector &p3, Vector &p4, Vector &outResult);
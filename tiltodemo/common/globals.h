@@ -8,8 +8,22 @@
 // This determines if we are using OpenGL to draw, or 
 // standard SDL functions. Both ways of doing things are provided
 // and you can take your pick as to which you want to explore.
-// set it to 1 to use OGL, 0 to use standard SDL functions
+// set it to 1 to use OGL, 0 to use standard SDL functions.
+// It can also be set from the command line (-DUSE_OGL=0), which is how
+// the benchmarks build without needing the OpenGL headers.
+#ifndef USE_OGL
 #define USE_OGL 1
+#endif
+
+// This picks the trig the vectors use (see vectorSinCos in geometry.h).
+// 0 is the regular sin, cos and atan2 from the math library. 1 is our own
+// fastSinCos and fastAtan2, which are quicker, but only good to 2e-9
+// (sines and cosines) and 3e-9 (angles), see geometry.cpp. The physics
+// uses it too, so a game recorded with one won't replay exactly with the
+// other.
+#ifndef USE_FAST_TRIG
+#define USE_FAST_TRIG 0
+#endif
 
 #endif
 
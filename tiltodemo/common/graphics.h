@@ -18,6 +18,15 @@
 
 #if USE_OGL
 #include <GLES/gl.h>
+
+class TextureFile;
+
+// a texture that images are packed in to. See buildAtlases in graphics_ogl.cpp
+struct AtlasTexture
+{
+	GLuint m_name;
+	int m_numImages; // it's deleted when the last of them is
+};
 #endif
 
 // the SDL screen surface
@@ -41,22 +50,29 @@ public:
 	Image();
 	virtual ~Image();
 
-	// load up the image from a file
-	void load(const char *fileName);
+	// load up the image from a file. See loadImage for the format and bDither
+	void load(const char *fileName, int format, SDL_bool bDither);
 
 #if USE_OGL
 	// in OGL, we only have to hang on to the image name,
-	// which is just an int.
+	// which is just an int. Images share textures (see
+	// AtlasTexture) so lots of images have the same name.
 	GLuint m_name;
 
-	// because OGL requires powers of 2 for
-	// the x and y size of textures, we will likely
-	// have blank unused space in our texture. Because of this
+	// because the image is only a part of its texture,
 	// we need to track the actual texture coordinates of the
 	// *content* portion of the texture. So when we blit it, we
-	// blit that part only.
+	// blit that part only. m_textureX and m_textureY are the
+	// top left, m_textureWidth and m_textureHeight the size.
+	GLfloat m_textureX;
+	GLfloat m_textureY;
 	GLfloat m_textureWidth;
 	GLfloat m_textureHeight;
+
+	// the image's pixels (see texturefile.h), until it's put in an
+	// atlas. Then it's NULL, and m_atlas is the texture it's in.
+	TextureFile *m_pending;
+	AtlasTexture *m_atlas;
 #else
 	// in SDL, we track an SDL_Surface
 	SDL_Surface *m_surface;
@@ -73,8 +89,25 @@ public:
 // init the graphics engine
 void graphics_init();
 
-// load an image of any supported file type
-Image *loadImage(const char *fileName);
+// what OGL keeps an image's pixels as. 16 bits a pixel takes half the
+// memory, and half the time to draw, of 32. The catch is fewer colors,
+// and for 4444 and 5551, less alpha. AUTO picks RGB565 if the image has no
+// alpha, RGBA5551 if every pixel is all there or not there at all, and 
+// RGBA4444 if it's got anything in between. Ignored by SDL.
+static const int IMAGE_FORMAT_AUTO = 0;
+static const int IMAGE_FORMAT_RGBA8888 = 1;
+static const int IMAGE_FORMAT_RGB565 = 2;
+static const int IMAGE_FORMAT_RGBA4444 = 3;
+static const int IMAGE_FORMAT_RGBA5551 = 4;
+
+// load an image of any supported file type. bDither breaks up the bands
+// you get in smooth colors when they're cut down to 16 bits, which is 
+// good for photos and gradients, but not so good for flat colors.
+Image *loadImage(const char *fileName, int format = IMAGE_FORMAT_AUTO, SDL_bool bDither = SDL_FALSE);
+
+// where OGL keeps the decoded images between runs (see texturefile.h).
+// NULL, to start with, doesn't keep them.
+void setTextureCacheDir(const char *dir);
 void freeImage(Image *img);
 
 // draw na image at the specified location
@@ -85,8 +118,34 @@ void drawImage(Image *img, int x, int y);
 // form 0xrrggbb
 void fillRect(int x, int y, int w, int h, int color);
 
+// static rects, like the blocks in the level. Rather than a fillRect for
+// each of them every frame, they're added once (and again only if they
+// change), and drawStaticRects draws all of them at once, moved left by
+// offsetX and up by offsetY. In OGL they're kept on the GPU.
+// There's room for MAX_STATIC_RECTS of them, which has to be enough for
+// all the blocks the game can have loaded (GameLogic::MAX_BLOCKS).
+static const int MAX_STATIC_RECTS = 2048;
+void clearStaticRects();
+void addStaticRect(int x, int y, int w, int h, int color);
+void drawStaticRects(int offsetX, int offsetY);
+
 // done with drawing, have OGL or SDL do their post drawing stuff
 void frameDone();
 
+// how many frames OGL can have queued up before frameDone waits for
+// them to be drawn (1 to 4, 2 to start with). More lets the CPU get
+// further ahead of the GPU, at the cost of what's on the screen being
+// that many frames behind.
+void setMaxFramesInFlight(int frames);
+
+// how many frames have been shown, and how many ms frameDone
+// spent waiting on them in total
+void getPresentStats(Uint32 &outFrames, Uint32 &outBlockedMs);
+
+// how many OGL calls (state changes and draws) the last frame made, and
+// how many state changes were skipped because OGL was already set that
+// way. Then the same, added up over every frame.
+void getGLCallStats(Uint32 &outFrameIssued, Uint32 &outFrameSkipped, Uint32 &outTotalIssued, Uint32 &outTotalSkipped);
+
 #endif
 
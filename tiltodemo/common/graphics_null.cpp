@@ -0,0 +1,109 @@
+// Null Graphics - stand-ins for everything in graphics.h and sound.h, for
+// the benchmarks (see the bench folder). They run GameLogic headless, with
+// no screen and no sound, so none of these ever really get called (the art
+// is never loaded, and m_bHeadless keeps the sounds quiet). They just have
+// to be there to link, without dragging in SDL_image, SDL_mixer or OpenGL.
+//
+// The game itself does NOT build this file. It gets graphics_ogl.cpp or
+// graphics_sdl.cpp, and sound.cpp.
+#include "globals.h"
+#include "SDL.h"
+#include "graphics.h"
+#include "sound.h"
+
+// the variable declaration of the screen global. There isn't one.
+SDL_Surface *g_screen = NULL;
+
+/********************* GRAPHICS ********************/
+/********************* GRAPHICS ********************/
+/********************* GRAPHICS ********************/
+
+void graphics_init()
+{
+}
+
+Image *loadImage(const char *, int, SDL_bool)
+{
+	return NULL;
+}
+
+void setTextureCacheDir(const char *)
+{
+}
+
+void freeImage(Image *)
+{
+}
+
+void drawImage(Image *, int, int)
+{
+}
+
+void fillRect(int, int, int, int, int)
+{
+}
+
+void clearStaticRects()
+{
+}
+
+void addStaticRect(int, int, int, int, int)
+{
+}
+
+void drawStaticRects(int, int)
+{
+}
+
+void frameDone()
+{
+}
+
+void setMaxFramesInFlight(int)
+{
+}
+
+// nothing is ever shown, and nothing ever goes to OGL
+void getPresentStats(Uint32 &outFrames, Uint32 &outBlockedMs)
+{
+	outFrames = 0;
+	outBlockedMs = 0;
+}
+
+void getGLCallStats(Uint32 &outFrameIssued, Uint32 &outFrameSkipped, Uint32 &outTotalIssued, Uint32 &outTotalSkipped)
+{
+	outFrameIssued = 0;
+	outFrameSkipped = 0;
+	outTotalIssued = 0;
+	outTotalSkipped = 0;
+}
+
+/********************* SOUND ********************/
+/********************* SOUND ********************/
+/********************* SOUND ********************/
+
+void initSound()
+{
+}
+
+void quitSound()
+{
+}
+
+void startStreamingMusic(const char *)
+{
+}
+
+Mix_Chunk *loadSound(const char *)
+{
+	return NULL;
+}
+
+void unloadSound(Mix_Chunk *)
+{
+}
+
+int playSound(Mix_Chunk *)
+{
+	return -1;
+}
@@ -9,6 +9,9 @@
 #include "graphics.h"
 #include "SDL.h"
 #include "SDL_image.h"
+#include "texturefile.h"
+#include <string.h>
+#include <stddef.h>
 
 // the variable declaration of the screen global
 // we need this even in the OGL build, because it
@@ -18,15 +21,176 @@ SDL_Surface *g_screen = NULL;
 // forward declarations
 int flipY(int y);
 int power_of_two(int input);
+static void addQuad(GLuint texture, int x, int y, int w, int h, GLfloat u1, GLfloat v1, GLfloat u2, GLfloat v2, int color);
+static void flushQuads();
+static void buildAtlases();
+static int packShelves(int width, int maxHeight, int &outWidth, int &outHeight);
+static void makeAtlas(int width, int height);
+static int textureSize(int size);
+static void waitForFrames();
+static void decodeImage(const char *fileName, TextureFile &outPixels);
+static void getImageFormat(TextureFile &rgba, int format, GLenum &outFormat, GLenum &outType);
+static void resetState();
+static void setTexture(GLuint texture);
+static void setBlendFunc(GLenum src, GLenum dst);
+static void setEnabled(GLenum cap, SDL_bool bEnabled);
+static void setClientState(GLenum array, SDL_bool bEnabled);
+static void setArrayBuffer(GLuint buffer);
 
-GLfloat g_coordinates[] = 
-{  
-   0.0, SCREEN_WIDTH,
-   SCREEN_HEIGHT, SCREEN_WIDTH,
-   0.0, 0.0,
-   SCREEN_HEIGHT, 0.0 
+// Batching. Going to OGL once for every sprite and every rect costs way more
+// than the drawing itself does (setting up the state, pointing at the arrays,
+// the draw call), and with a few hundred things on the screen that's most of
+// the frame. So drawImage and fillRect don't draw anything. They just add a
+// quad to a list, and all the quads go to OGL at once in frameDone, with one
+// draw call for each texture instead of one for each quad.
+//
+// Quads are grouped in to batches, one texture each (0 for the filled rects).
+// A new quad goes in to an earlier batch with the same texture if it can, but
+// that batch gets drawn before the batches that came after it, so it's only
+// allowed if the quad doesn't overlap any of those. Otherwise something that
+// was supposed to be drawn under it would end up on top. If there's nowhere
+// for it, it starts a new batch.
+static const int MAX_QUADS = 1024;
+static const int MAX_BATCHES = 256;
+
+// how many batches back we look for one with the same texture. Past this
+// the quad just starts a new batch, so adding a quad doesn't get slow.
+static const int MAX_BATCH_LOOKBACK = 8;
+
+// one corner of a quad. Everything OGL needs to know is in here, so all three
+// arrays point in to the same place and never have to be set again.
+struct BatchVertex
+{
+	GLfloat x, y;
+	GLfloat u, v;
+	GLubyte color[4];
+};
+
+struct Batch
+{
+	GLuint texture;
+	int numQuads;
+
+	// the screen area the batch's quads cover, for the overlap check.
+	// In the game's coordinates (y goes down), x2 and y2 are past the end.
+	int x1, y1, x2, y2;
+
+	// where its quads start in s_sorted (worked out in flushQuads)
+	int first;
 };
 
+// the quads, in the order they were added, and which batch each is in
+static BatchVertex s_quads[MAX_QUADS*4];
+static int s_quadBatch[MAX_QUADS];
+static int s_numQuads = 0;
+
+static Batch s_batches[MAX_BATCHES];
+static int s_numBatches = 0;
+
+// the quads again, in batch order. This is what OGL actually draws from.
+static BatchVertex s_sorted[MAX_QUADS*4];
+
+// Static rects. They go in to a vertex buffer, which lives on the GPU, so
+// once they're uploaded they cost one draw call a frame and nothing else.
+// s_staticRects is our copy, for when they change and need uploading again.
+// How many there can be (see graphics.h) has nothing to do with how many
+// quads we batch up between flushes.
+static BatchVertex s_staticRects[MAX_STATIC_RECTS*4];
+static int s_numStaticRects = 0;
+static SDL_bool s_bStaticRectsDirty = SDL_FALSE;
+static GLuint s_staticBuffer = 0;
+
+// two triangles for each quad, made once at init. The corners of a quad are
+// top left, top right, bottom left, bottom right. The batched quads and the
+// static rects both draw with these, so there's enough for whichever has
+// more. The indices are GLushorts, so they can only reach 16384 quads' worth
+// of corners, and the typedef won't compile if we ever want more than that.
+static const int MAX_INDEXED_QUADS = MAX_STATIC_RECTS > MAX_QUADS ? MAX_STATIC_RECTS : MAX_QUADS;
+typedef char IndexedQuadsFitInShorts[MAX_INDEXED_QUADS*4 <= 65536 ? 1 : -1];
+static GLushort s_indices[MAX_INDEXED_QUADS*6];
+
+// Atlases. The biggest one we'll make, and the gap left between images in one
+static const int MAX_ATLAS_SIZE = 1024;
+static const int ATLAS_PADDING = 1;
+
+// images that have been loaded, but aren't in an atlas yet, and where
+// packShelves put each of them
+static const int MAX_PENDING_IMAGES = 64;
+static Image *s_pending[MAX_PENDING_IMAGES];
+static int s_placeX[MAX_PENDING_IMAGES];
+static int s_placeY[MAX_PENDING_IMAGES];
+static int s_numPending = 0;
+
+// the format of the atlas we're packing
+static GLenum s_atlasFormat;
+static GLenum s_atlasType;
+
+// if textures can be any size, not just powers of 2. Not every device
+// can, but the ones that can let the atlas be just as big as it needs to be.
+static SDL_bool s_bAnySizeTextures = SDL_FALSE;
+
+// Frames in flight. OGL doesn't draw anything when we tell it to, it queues
+// it up and the GPU gets to it later. If the CPU doesn't wait, it can get the
+// next frame ready while the GPU is drawing this one. But it can't get too far
+// ahead either, or what's on the screen lags behind the ball. So we let up to
+// s_maxFramesInFlight frames be queued, and only wait when there's that many.
+//
+// To know when a frame is done we need fences, which aren't in OGL ES 1.1,
+// but lots of devices have GL_NV_fence. Without it, we glFinish (which waits
+// for everything) once every s_maxFramesInFlight frames instead. 
+static const int DEFAULT_FRAMES_IN_FLIGHT = 2;
+static const int MAX_FRAMES_IN_FLIGHT = 4;
+static int s_maxFramesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+
+// GL_NV_fence, if we have it. We get the functions from SDL, since
+// they're not in the headers.
+#define GL_ALL_COMPLETED_NV 0x84F2
+typedef void (GL_APIENTRY *GenFencesFunc)(GLsizei n, GLuint *fences);
+typedef void (GL_APIENTRY *SetFenceFunc)(GLuint fence, GLenum condition);
+typedef void (GL_APIENTRY *FinishFenceFunc)(GLuint fence);
+static GenFencesFunc s_glGenFencesNV = NULL;
+static SetFenceFunc s_glSetFenceNV = NULL;
+static FinishFenceFunc s_glFinishFenceNV = NULL;
+
+// a fence for each frame in flight, going round and round. s_fenceSet
+// says which ones have a frame behind them.
+static GLuint s_fences[MAX_FRAMES_IN_FLIGHT];
+static SDL_bool s_fenceSet[MAX_FRAMES_IN_FLIGHT];
+static int s_nextFence = 0;
+
+// without fences, how many frames since we last glFinish'd
+static int s_framesSinceFinish = 0;
+
+// how many frames we've shown, and how long the CPU spent stuck in
+// frameDone waiting on them, for getPresentStats
+static Uint32 s_framesPresented = 0;
+static Uint32 s_presentBlockedMs = 0;
+
+// The state cache. Telling OGL to do what it's already doing isn't free, the
+// driver still has to check, and some drivers do a lot more than check. So we
+// keep a copy of the state we care about, and the set functions below only
+// call OGL when it's actually changing. Everything in here has to go through
+// them, or the copy ends up wrong.
+//
+// -1 in the enables means we don't know, so the next set always goes through.
+static GLuint s_stateTexture;
+static GLenum s_stateBlendSrc;
+static GLenum s_stateBlendDst;
+static int s_stateTexturing;
+static int s_stateBlending;
+static int s_stateVertexArray;
+static int s_stateTexCoordArray;
+static int s_stateColorArray;
+static GLuint s_stateArrayBuffer; // which buffer the arrays point in to, 0 for s_sorted
+
+// how many OGL calls we made (state changes and draws), and how many state
+// changes the cache skipped, this frame and last frame. See getGLCallStats
+static Uint32 s_callsIssued = 0;
+static Uint32 s_callsSkipped = 0;
+static Uint32 s_lastFrameCallsIssued = 0;
+static Uint32 s_lastFrameCallsSkipped = 0;
+static Uint32 s_totalCallsIssued = 0;
+static Uint32 s_totalCallsSkipped = 0;
 
 
 // init ogl. This is farily standard. Palm's implementation of
@@ -39,104 +203,515 @@ void graphics_init()
 	glOrthof((GLfloat)0, (GLfloat)SCREEN_WIDTH, (GLfloat)0, (GLfloat)SCREEN_HEIGHT, (GLfloat)-1, (GLfloat)1);
 	glMatrixMode(GL_MODELVIEW);
 
-	// set up the basic rendering states
-	glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
-	glEnable(GL_TEXTURE_2D);
+	// set up the basic rendering states. Texturing and blending get turned
+	// on and off by the batches, since the filled rects don't need either.
+	resetState();
+	setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	setEnabled(GL_TEXTURE_2D, SDL_TRUE);
 	glTexEnvi(GL_TEXTURE_ENV, GL_TEXTURE_ENV_MODE, GL_REPLACE);
-	glEnableClientState(GL_VERTEX_ARRAY);
-	glEnable(GL_BLEND);
+	setEnabled(GL_BLEND, SDL_TRUE);
+
+	// the 16 bit formats have rows that aren't always a multiple of 4 bytes
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+	// everything but the static rects is drawn out of s_sorted,
+	// so that's what the arrays point at to start with
+	setClientState(GL_VERTEX_ARRAY, SDL_TRUE);
+	setClientState(GL_TEXTURE_COORD_ARRAY, SDL_TRUE);
+	setClientState(GL_COLOR_ARRAY, SDL_TRUE);
+	setArrayBuffer(0);
+
+	for ( int i=0 ; i<MAX_INDEXED_QUADS ; i++ )
+	{
+		GLushort *index = &s_indices[i*6];
+		GLushort corner = (GLushort)(i*4);
+		index[0] = corner;
+		index[1] = (GLushort)(corner+1);
+		index[2] = (GLushort)(corner+2);
+		index[3] = (GLushort)(corner+2);
+		index[4] = (GLushort)(corner+1);
+		index[5] = (GLushort)(corner+3);
+	}
+	s_numQuads = 0;
+	s_numBatches = 0;
+
+	// see if textures have to be powers of 2. The IMG and APPLE versions
+	// come with strings attached (no mipmaps, no wrapping), but we don't
+	// need either of those.
+	const char *extensions = (const char *)glGetString(GL_EXTENSIONS);
+	s_bAnySizeTextures = (SDL_bool)(extensions != NULL && (
+		strstr(extensions, "GL_OES_texture_npot") != NULL ||
+		strstr(extensions, "GL_ARB_texture_non_power_of_two") != NULL ||
+		strstr(extensions, "GL_IMG_texture_npot") != NULL ||
+		strstr(extensions, "GL_APPLE_texture_2D_limited_npot") != NULL));
+
+	// see if there are fences to pace the frames with
+	if ( extensions != NULL && strstr(extensions, "GL_NV_fence") != NULL )
+	{
+		s_glGenFencesNV = (GenFencesFunc)SDL_GL_GetProcAddress("glGenFencesNV");
+		s_glSetFenceNV = (SetFenceFunc)SDL_GL_GetProcAddress("glSetFenceNV");
+		s_glFinishFenceNV = (FinishFenceFunc)SDL_GL_GetProcAddress("glFinishFenceNV");
+		if ( s_glGenFencesNV == NULL || s_glSetFenceNV == NULL || s_glFinishFenceNV == NULL )
+		{
+			s_glGenFencesNV = NULL;
+		}
+		else
+		{
+			s_glGenFencesNV(MAX_FRAMES_IN_FLIGHT, s_fences);
+		}
+	}
+	for ( int i=0 ; i<MAX_FRAMES_IN_FLIGHT ; i++ )
+	{
+		s_fenceSet[i] = SDL_FALSE;
+	}
+	s_nextFence = 0;
+	s_framesSinceFinish = 0;
+}
+
+void setMaxFramesInFlight(int frames)
+{
+	if ( frames < 1 ) frames = 1;
+	if ( frames > MAX_FRAMES_IN_FLIGHT ) frames = MAX_FRAMES_IN_FLIGHT;
 
-	glTexCoordPointer(2, GL_FLOAT, 0, g_coordinates); 
+	// start over with nothing in flight, so the fences we have
+	// don't get mixed up with the new count
+	glFinish();
+	for ( int i=0 ; i<MAX_FRAMES_IN_FLIGHT ; i++ )
+	{
+		s_fenceSet[i] = SDL_FALSE;
+	}
+	s_nextFence = 0;
+	s_framesSinceFinish = 0;
+	s_maxFramesInFlight = frames;
 }
 
-Image *loadImage(const char *fileName)
+void getPresentStats(Uint32 &outFrames, Uint32 &outBlockedMs)
+{
+	outFrames = s_framesPresented;
+	outBlockedMs = s_presentBlockedMs;
+}
+
+void getGLCallStats(Uint32 &outFrameIssued, Uint32 &outFrameSkipped, Uint32 &outTotalIssued, Uint32 &outTotalSkipped)
+{
+	outFrameIssued = s_lastFrameCallsIssued;
+	outFrameSkipped = s_lastFrameCallsSkipped;
+	outTotalIssued = s_totalCallsIssued;
+	outTotalSkipped = s_totalCallsSkipped;
+}
+
+Image *loadImage(const char *fileName, int format, SDL_bool bDither)
 {
 	// simply instance an Image, and tell it to load.
 	Image *ret = new Image();
-	ret->load(fileName);
+	ret->load(fileName, format, bDither);
 	return ret;
 }
 
+void setTextureCacheDir(const char *dir)
+{
+	TextureFile::setCacheDir(dir);
+}
+
 void freeImage(Image *img)
 {
+	// there might be quads waiting to be drawn with it
+	flushQuads();
 	delete img;
 }
 
 void drawImage(Image *img, int x, int y)
 {
-	GLfloat fX = (GLfloat)x;
+	// the first time anything new is drawn, everything new goes in an atlas
+	if ( img->m_pending != NULL )
+	{
+		buildAtlases();
+	}
 
-	// see flipY for an explanation of this
-	GLfloat fY = (GLfloat)(flipY(img->m_height+y));
-	
-	GLfloat	coordinates[] = { 0, img->m_textureHeight, img->m_textureWidth, img->m_textureHeight, 0, 0, img->m_textureWidth, 0 };
-	GLfloat		vertices[] = 
-	{ 
-		fX, fY, 0.0,
-		img->m_width+fX, fY, 0.0,
-		fX, img->m_height+fY, 0.0,
-		img->m_width+fX, img->m_height+fY, 0.0 
-	};	
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA); 
-	
-	glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-
-	glColor4f(1.0, 1.0, 1.0, 1.0);
-	glBindTexture(GL_TEXTURE_2D, img->m_name);
-	glVertexPointer(3, GL_FLOAT, 0, vertices);
-	glTexCoordPointer(2, GL_FLOAT, 0, coordinates);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);	
-
-	glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+	// the image's color doesn't matter, the texture replaces it
+	addQuad(img->m_name, x, y, img->m_width, img->m_height,
+		img->m_textureX, img->m_textureY, img->m_textureX + img->m_textureWidth, img->m_textureY + img->m_textureHeight, 0xffffff);
 }
 
 void fillRect(int x, int y, int w, int h, int color)
 {
-	// see flipY to see why we're doing this
-	y = flipY(y);
+	// no texture, so the color is what gets drawn
+	addQuad(0, x, y, w, h, 0, 0, 0, 0, color);
+}
 
-	// set the color, OGL style. This requires us to
-	// know the individual components
-	int r = (color&0x00ff0000)>>16;
-	int g = (color&0x0000ff00)>>8;
-	int b = (color&0x000000ff);
-	GLfloat colorRed = ((float)r)/(float)255.0;
-	GLfloat colorGreen = ((float)g)/(float)255.0;
-	GLfloat colorBlue = ((float)b)/(float)255.0;
-	glColor4f(colorRed, colorGreen, colorBlue, 255.0);
+void clearStaticRects()
+{
+	s_numStaticRects = 0;
+	s_bStaticRectsDirty = SDL_TRUE;
+}
 
-	// drawing raw primatives, so we need to set
-	// up for that.
-	glBindTexture(GL_TEXTURE_2D, 0);
+void addStaticRect(int x, int y, int w, int h, int color)
+{
+	if ( s_numStaticRects == MAX_STATIC_RECTS )
+	{
+		printf("Too many static rects, the most is %d\n", MAX_STATIC_RECTS);
+		return;
+	}
 
-	// make the array of points to draw
+	// the same as a quad from fillRect (see addQuad), except y is only
+	// flipped, not moved by the camera. drawStaticRects does that.
 	GLfloat fX = (GLfloat)x;
-	GLfloat fY = (GLfloat)y;
-	GLfloat fX2 = (GLfloat)(x+w);
-	GLfloat fY2 = (GLfloat)(y-h); // we subtract because down is positive in OGL land
-	
-	const GLfloat vertices[] = 
-	{
-		fX2, fY, 0.0,
-		fX, fY, 0.0,
-		fX2, fY2, 0.0,
-		fX, fY2, 0.0
-	};
-	
-	// draw the filled rect
-	glVertexPointer(3, GL_FLOAT, 0, vertices);
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	GLfloat fX2 = (GLfloat)(x + w);
+	GLfloat fY = (GLfloat)flipY(y);
+	GLfloat fY2 = (GLfloat)flipY(y + h);
+	BatchVertex *v = &s_staticRects[s_numStaticRects*4];
+	v[0].x = fX;  v[0].y = fY;
+	v[1].x = fX2; v[1].y = fY;
+	v[2].x = fX;  v[2].y = fY2;
+	v[3].x = fX2; v[3].y = fY2;
+	for ( int i=0 ; i<4 ; i++ )
+	{
+		v[i].u = 0;
+		v[i].v = 0;
+		v[i].color[0] = (GLubyte)((color&0x00ff0000)>>16);
+		v[i].color[1] = (GLubyte)((color&0x0000ff00)>>8);
+		v[i].color[2] = (GLubyte)(color&0x000000ff);
+		v[i].color[3] = 255;
+	}
+	s_numStaticRects++;
+	s_bStaticRectsDirty = SDL_TRUE;
+}
+
+void drawStaticRects(int offsetX, int offsetY)
+{
+	if ( s_numStaticRects == 0 )
+	{
+		return;
+	}
+
+	// whatever was drawn before us has to go first, so it ends up underneath
+	flushQuads();
+
+	if ( s_staticBuffer == 0 )
+	{
+		glGenBuffers(1, &s_staticBuffer);
+		s_callsIssued++;
+	}
+	setArrayBuffer(s_staticBuffer);
+	if ( s_bStaticRectsDirty )
+	{
+		glBufferData(GL_ARRAY_BUFFER, sizeof(BatchVertex)*4*s_numStaticRects, s_staticRects, GL_STATIC_DRAW);
+		s_bStaticRectsDirty = SDL_FALSE;
+		s_callsIssued++;
+	}
+
+	// they're solid, like the filled rects. Moving them left by offsetX
+	// and up by offsetY is right and down in OGL, since y is flipped
+	setEnabled(GL_TEXTURE_2D, SDL_FALSE);
+	setEnabled(GL_BLEND, SDL_FALSE);
+	glPushMatrix();
+	glTranslatef((GLfloat)-offsetX, (GLfloat)offsetY, 0);
+	glDrawElements(GL_TRIANGLES, s_numStaticRects*6, GL_UNSIGNED_SHORT, s_indices);
+	glPopMatrix();
+	s_callsIssued += 4;
 }
 
 void frameDone()
 {
-	// tell OGL that we're done giving it operations
-	// and it's time to execute them
-	glFlush();
-	glFinish();
+	// everything we've been saving up for this frame
+	flushQuads();
+
+	// that's all the OGL calls for this frame
+	s_lastFrameCallsIssued = s_callsIssued;
+	s_lastFrameCallsSkipped = s_callsSkipped;
+	s_totalCallsIssued += s_callsIssued;
+	s_totalCallsSkipped += s_callsSkipped;
+	s_callsIssued = 0;
+	s_callsSkipped = 0;
+
+	// we used to glFinish here, which waited for the GPU to draw the whole
+	// frame before we could start on the next one. Now we only wait if too
+	// many frames are queued up already. The swap can wait too, depending
+	// on the driver, so it counts as being stuck.
+	Uint32 start = SDL_GetTicks();
+	waitForFrames();
 
-	// tell SDL it's time to flip surfaces
+	// tell SDL it's time to flip surfaces. This flushes
+	// everything we've told OGL to do, so it gets started on it.
 	SDL_GL_SwapBuffers();
+
+	s_presentBlockedMs += SDL_GetTicks() - start;
+	s_framesPresented++;
+}
+
+// wait until there's room for one more frame in flight, then
+// count this one as being in flight
+static void waitForFrames()
+{
+	if ( s_glGenFencesNV != NULL )
+	{
+		// the fence we're about to reuse is the one from
+		// s_maxFramesInFlight frames ago. Once that frame is done
+		// there's only the ones after it left.
+		int fence = s_nextFence;
+		if ( s_fenceSet[fence] )
+		{
+			s_glFinishFenceNV(s_fences[fence]);
+		}
+		s_glSetFenceNV(s_fences[fence], GL_ALL_COMPLETED_NV);
+		s_fenceSet[fence] = SDL_TRUE;
+		s_nextFence = (fence + 1) % s_maxFramesInFlight;
+	}
+	else
+	{
+		// no fences, so the only way to know is to wait for all of it
+		s_framesSinceFinish++;
+		if ( s_framesSinceFinish >= s_maxFramesInFlight )
+		{
+			glFinish();
+			s_framesSinceFinish = 0;
+		}
+	}
+}
+
+
+/********************* BATCHING ********************/
+/********************* BATCHING ********************/
+/********************* BATCHING ********************/
+static void addQuad(GLuint texture, int x, int y, int w, int h, GLfloat u1, GLfloat v1, GLfloat u2, GLfloat v2, int color)
+{
+	if ( s_numQuads == MAX_QUADS )
+	{
+		flushQuads();
+	}
+
+	// find a batch for it. Walk back from the newest batch looking for one
+	// with our texture, and stop at the first one we overlap, since we have
+	// to be drawn after that one.
+	int x2 = x + w;
+	int y2 = y + h;
+	int batch = -1;
+	int oldest = s_numBatches - MAX_BATCH_LOOKBACK;
+	if ( oldest < 0 ) oldest = 0;
+	for ( int i=s_numBatches-1 ; i>=oldest ; i-- )
+	{
+		Batch &b = s_batches[i];
+		if ( b.texture == texture )
+		{
+			batch = i;
+			break;
+		}
+		if ( x < b.x2 && b.x1 < x2 && y < b.y2 && b.y1 < y2 )
+		{
+			break;
+		}
+	}
+
+	if ( batch < 0 )
+	{
+		if ( s_numBatches == MAX_BATCHES )
+		{
+			flushQuads();
+		}
+		batch = s_numBatches++;
+		Batch &b = s_batches[batch];
+		b.texture = texture;
+		b.numQuads = 0;
+		b.x1 = x;
+		b.y1 = y;
+		b.x2 = x2;
+		b.y2 = y2;
+	}
+	else
+	{
+		Batch &b = s_batches[batch];
+		if ( x < b.x1 ) b.x1 = x;
+		if ( y < b.y1 ) b.y1 = y;
+		if ( x2 > b.x2 ) b.x2 = x2;
+		if ( y2 > b.y2 ) b.y2 = y2;
+	}
+	s_batches[batch].numQuads++;
+	s_quadBatch[s_numQuads] = batch;
+
+	// see flipY for why the y's are flipped. The texture coordinates only
+	// cover the part of the texture that has the image in it (see makeAtlas).
+	GLfloat fX = (GLfloat)x;
+	GLfloat fX2 = (GLfloat)x2;
+	GLfloat fY = (GLfloat)flipY(y);
+	GLfloat fY2 = (GLfloat)flipY(y2);
+	GLubyte r = (GLubyte)((color&0x00ff0000)>>16);
+	GLubyte g = (GLubyte)((color&0x0000ff00)>>8);
+	GLubyte b = (GLubyte)(color&0x000000ff);
+
+	BatchVertex *v = &s_quads[s_numQuads*4];
+	v[0].x = fX;  v[0].y = fY;  v[0].u = u1; v[0].v = v1;
+	v[1].x = fX2; v[1].y = fY;  v[1].u = u2; v[1].v = v1;
+	v[2].x = fX;  v[2].y = fY2; v[2].u = u1; v[2].v = v2;
+	v[3].x = fX2; v[3].y = fY2; v[3].u = u2; v[3].v = v2;
+	for ( int i=0 ; i<4 ; i++ )
+	{
+		v[i].color[0] = r;
+		v[i].color[1] = g;
+		v[i].color[2] = b;
+		v[i].color[3] = 255;
+	}
+	s_numQuads++;
+}
+
+static void flushQuads()
+{
+	if ( s_numQuads == 0 )
+	{
+		return;
+	}
+
+	// put the quads in batch order. Each batch's quads stay in the order they
+	// were added, so the ones added later still end up on top.
+	int first = 0;
+	for ( int i=0 ; i<s_numBatches ; i++ )
+	{
+		s_batches[i].first = first;
+		first += s_batches[i].numQuads;
+		s_batches[i].numQuads = 0;
+	}
+	for ( int i=0 ; i<s_numQuads ; i++ )
+	{
+		Batch &b = s_batches[s_quadBatch[i]];
+		memcpy(&s_sorted[(b.first + b.numQuads)*4], &s_quads[i*4], sizeof(BatchVertex)*4);
+		b.numQuads++;
+	}
+
+	// and draw them, a batch at a time. The state cache takes care of
+	// not setting anything twice.
+	setArrayBuffer(0);
+	for ( int i=0 ; i<s_numBatches ; i++ )
+	{
+		Batch &b = s_batches[i];
+		if ( b.texture == 0 )
+		{
+			// the filled rects are solid, so there's nothing to blend
+			setEnabled(GL_TEXTURE_2D, SDL_FALSE);
+			setEnabled(GL_BLEND, SDL_FALSE);
+		}
+		else
+		{
+			setEnabled(GL_TEXTURE_2D, SDL_TRUE);
+			setEnabled(GL_BLEND, SDL_TRUE);
+			setTexture(b.texture);
+		}
+		glDrawElements(GL_TRIANGLES, b.numQuads*6, GL_UNSIGNED_SHORT, &s_indices[b.first*6]);
+		s_callsIssued++;
+	}
+
+	s_numQuads = 0;
+	s_numBatches = 0;
+}
+
+
+/********************* STATE CACHE ********************/
+/********************* STATE CACHE ********************/
+/********************* STATE CACHE ********************/
+// forget what we know, so the next set of everything goes through
+static void resetState()
+{
+	s_stateTexture = (GLuint)-1;
+	s_stateBlendSrc = 0;
+	s_stateBlendDst = 0;
+	s_stateTexturing = -1;
+	s_stateBlending = -1;
+	s_stateVertexArray = -1;
+	s_stateTexCoordArray = -1;
+	s_stateColorArray = -1;
+	s_stateArrayBuffer = (GLuint)-1;
+}
+
+static void setTexture(GLuint texture)
+{
+	if ( texture == s_stateTexture )
+	{
+		s_callsSkipped++;
+		return;
+	}
+	glBindTexture(GL_TEXTURE_2D, texture);
+	s_stateTexture = texture;
+	s_callsIssued++;
+}
+
+static void setBlendFunc(GLenum src, GLenum dst)
+{
+	if ( src == s_stateBlendSrc && dst == s_stateBlendDst )
+	{
+		s_callsSkipped++;
+		return;
+	}
+	glBlendFunc(src, dst);
+	s_stateBlendSrc = src;
+	s_stateBlendDst = dst;
+	s_callsIssued++;
+}
+
+// GL_TEXTURE_2D or GL_BLEND
+static void setEnabled(GLenum cap, SDL_bool bEnabled)
+{
+	int &state = (cap == GL_TEXTURE_2D) ? s_stateTexturing : s_stateBlending;
+	if ( state == (int)bEnabled )
+	{
+		s_callsSkipped++;
+		return;
+	}
+	if ( bEnabled )
+	{
+		glEnable(cap);
+	}
+	else
+	{
+		glDisable(cap);
+	}
+	state = (int)bEnabled;
+	s_callsIssued++;
+}
+
+// GL_VERTEX_ARRAY, GL_TEXTURE_COORD_ARRAY or GL_COLOR_ARRAY
+static void setClientState(GLenum array, SDL_bool bEnabled)
+{
+	int &state = (array == GL_VERTEX_ARRAY) ? s_stateVertexArray : 
+		((array == GL_TEXTURE_COORD_ARRAY) ? s_stateTexCoordArray : s_stateColorArray);
+	if ( state == (int)bEnabled )
+	{
+		s_callsSkipped++;
+		return;
+	}
+	if ( bEnabled )
+	{
+		glEnableClientState(array);
+	}
+	else
+	{
+		glDisableClientState(array);
+	}
+	state = (int)bEnabled;
+	s_callsIssued++;
+}
+
+// point the arrays at a vertex buffer full of BatchVertex, or at s_sorted
+// if it's 0
+static void setArrayBuffer(GLuint buffer)
+{
+	if ( buffer == s_stateArrayBuffer )
+	{
+		s_callsSkipped++;
+		return;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, buffer);
+	if ( buffer == 0 )
+	{
+		glVertexPointer(2, GL_FLOAT, sizeof(BatchVertex), &s_sorted[0].x);
+		glTexCoordPointer(2, GL_FLOAT, sizeof(BatchVertex), &s_sorted[0].u);
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BatchVertex), s_sorted[0].color);
+	}
+	else
+	{
+		// in a buffer, the pointers are where in the buffer to look
+		glVertexPointer(2, GL_FLOAT, sizeof(BatchVertex), (const GLvoid *)offsetof(BatchVertex, x));
+		glTexCoordPointer(2, GL_FLOAT, sizeof(BatchVertex), (const GLvoid *)offsetof(BatchVertex, u));
+		glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(BatchVertex), (const GLvoid *)offsetof(BatchVertex, color));
+	}
+	s_stateArrayBuffer = buffer;
+	s_callsIssued += 4;
 }
 
 
@@ -146,21 +721,87 @@ void frameDone()
 Image::Image()
 {
 	m_name = 0;
+	m_textureX = 0;
+	m_textureY = 0;
+	m_textureWidth = 0;
+	m_textureHeight = 0;
+	m_pending = NULL;
+	m_atlas = NULL;
 }
 
 Image::~Image()
 {
-	// free the image (if any)
-	if ( m_name != 0 )
+	// if it never made it in to an atlas, it's still on the list
+	if ( m_pending != NULL )
+	{
+		for ( int i=0 ; i<s_numPending ; i++ )
+		{
+			if ( s_pending[i] == this )
+			{
+				s_pending[i] = s_pending[--s_numPending];
+				break;
+			}
+		}
+		delete m_pending;
+		m_pending = NULL;
+	}
+
+	// free the texture, if we were the last image in it
+	if ( m_atlas != NULL )
 	{
-		glDeleteTextures(1, &m_name);
+		m_atlas->m_numImages--;
+		if ( m_atlas->m_numImages == 0 )
+		{
+			// deleting the bound texture binds 0 instead
+			if ( s_stateTexture == m_atlas->m_name )
+			{
+				s_stateTexture = 0;
+			}
+			glDeleteTextures(1, &m_atlas->m_name);
+			delete m_atlas;
+		}
+		m_atlas = NULL;
 		m_name = 0;
 	}
 }
 
-// load an image into an OGL surface. The sent-in
-// parameter is the file name. 
-void Image::load(const char *fileName)
+// load an image. The sent-in parameter is the file name. 
+// This doesn't make the OGL texture yet, the image just waits
+// on the pending list until it's drawn. See buildAtlases
+void Image::load(const char *fileName, int format, SDL_bool bDither)
+{
+	// what we need is the pixels, in a format OGL takes. If the texture 
+	// cache has them from last time, made the way we're asking for now,
+	// that's all there is to it. Otherwise we decode the image, convert it,
+	// and save what we got for next time.
+	Uint32 settings = (Uint32)format | (bDither ? 0x100 : 0);
+	TextureFile *pixels = new TextureFile();
+	if ( !pixels->open(fileName) || pixels->m_settings != settings )
+	{
+		TextureFile rgba;
+		decodeImage(fileName, rgba);
+		GLenum glFormat, glType;
+		getImageFormat(rgba, format, glFormat, glType);
+		pixels->convert(rgba, glFormat, glType, bDither);
+		pixels->m_settings = settings;
+		pixels->save(fileName);
+	}
+
+	// set up our internals
+	m_width = pixels->m_width;
+	m_height = pixels->m_height;
+
+	// and wait to be put in an atlas
+	if ( s_numPending == MAX_PENDING_IMAGES )
+	{
+		buildAtlases();
+	}
+	m_pending = pixels;
+	s_pending[s_numPending++] = this;
+}
+
+// decode an image file in to RGBA pixels
+static void decodeImage(const char *fileName, TextureFile &outPixels)
 {
 	// we start by loading an SDL surface. 
 	// this is the exact same thing we do in 
@@ -174,38 +815,35 @@ void Image::load(const char *fileName)
 		exit(1);
 	}
 
-	// set up our internals
-	m_width = surface->w;
-	m_height = surface->h;
-
-	// and now, it's time to make an OGL image out of this SDL image
-	// OGL requires powers of 2 for the width and height
-	int pow2W = power_of_two(surface->w);
-	int pow2H = power_of_two(surface->h);
-
-	// we wont necessarily be using the whole texture.
-	// the texture will be the power of two sizes. 
-	// So we note the texture coordinates needed to 
-	// end up using *only* the actual image portion of the texture.
-	m_textureWidth = (GLfloat)m_width / (GLfloat)pow2W;	
-	m_textureHeight = (GLfloat)m_height / (GLfloat)pow2H;	
-
-	// now, we make and SDL image that is RGB
+	// if SDL_image gave us RGBA already (PNGs with alpha usually come
+	// out that way), it's just a copy
+	outPixels.create(surface->w, surface->h, GL_RGBA, GL_UNSIGNED_BYTE);
+	SDL_PixelFormat *format = surface->format;
+#if SDL_BYTEORDER == SDL_LIL_ENDIAN
+	if ( format->BitsPerPixel == 32 && format->Rmask == 0x000000FF && format->Gmask == 0x0000FF00 && format->Bmask == 0x00FF0000 && format->Amask == 0xFF000000 )
+#else
+	if ( format->BitsPerPixel == 32 && format->Rmask == 0xFF000000 && format->Gmask == 0x00FF0000 && format->Bmask == 0x0000FF00 && format->Amask == 0x000000FF )
+#endif
+	{
+		SDL_LockSurface(surface);
+		for ( int y=0 ; y<surface->h ; y++ )
+		{
+			memcpy(outPixels.m_pixels + y*outPixels.getPitch(), (Uint8 *)surface->pixels + y*surface->pitch, outPixels.getPitch());
+		}
+		SDL_UnlockSurface(surface);
+		SDL_FreeSurface(surface);
+		return;
+	}
+
+	// otherwise, we make and SDL image that is RGBA, right on top of
+	// the pixels we're making, and copy the image in to it. 
 	// this is complicated by the rgba masks being
 	// different in big endian / little endian modes. So
 	// we compile-switch for that.
-	// Why are we making this intermediate image?
-	// because we need to create an OGL image with all data
-	// in hand at the time of creation. and that means we
-	// need an SDL image that is already set up to
-	// be the power-of-two compliant sizes. So all we're doing
-	// here is making another SDL image, one that encodes as
-	// RGB, which has power of two sizes, and we'll copy the original
-	// image into this one. 
-	SDL_Surface *image = SDL_CreateRGBSurface(
-			SDL_SWSURFACE,
-			pow2W, pow2H,
-			32,
+	SDL_Surface *image = SDL_CreateRGBSurfaceFrom(
+			outPixels.m_pixels,
+			surface->w, surface->h,
+			32, outPixels.getPitch(),
 #if SDL_BYTEORDER == SDL_LIL_ENDIAN /* OpenGL RGBA masks */
 			0x000000FF, 
 			0x0000FF00, 
@@ -236,14 +874,8 @@ void Image::load(const char *fileName)
 		SDL_SetAlpha(surface, 0, 0);
 	}
 
-	// copy the original image into our new power of 2
-	// RGB image.
-	SDL_Rect area;
-	area.x = 0;
-	area.y = 0;
-	area.w = (Uint16)m_width;
-	area.h = (Uint16)m_height;
-	SDL_BlitSurface(surface, &area, image, &area);
+	// copy the original image into our RGBA one
+	SDL_BlitSurface(surface, NULL, image, NULL);
 
 	// put these guys back the way we found them 
 	if ( (saved_flags & SDL_SRCALPHA) == SDL_SRCALPHA ) 
@@ -251,26 +883,242 @@ void Image::load(const char *fileName)
 		SDL_SetAlpha(surface, saved_flags, saved_alpha);
 	}
 
-	// Create an OpenGL texture for the image 
-	glGenTextures(1, &m_name);
-	glBindTexture(GL_TEXTURE_2D, m_name);
+	// the pixels are ours now, so neither surface is needed
+	SDL_FreeSurface(image);
+	SDL_FreeSurface(surface);
+}
+
+// the OGL format and type for an image (see IMAGE_FORMAT_AUTO)
+static void getImageFormat(TextureFile &rgba, int format, GLenum &outFormat, GLenum &outType)
+{
+	if ( format == IMAGE_FORMAT_AUTO )
+	{
+		switch ( rgba.getAlphaKind() )
+		{
+		case TextureFile::ALPHA_NONE: format = IMAGE_FORMAT_RGB565; break;
+		case TextureFile::ALPHA_ONE_BIT: format = IMAGE_FORMAT_RGBA5551; break;
+		default: format = IMAGE_FORMAT_RGBA4444; break;
+		}
+	}
+	switch ( format )
+	{
+	case IMAGE_FORMAT_RGB565: outFormat = GL_RGB; outType = GL_UNSIGNED_SHORT_5_6_5; break;
+	case IMAGE_FORMAT_RGBA4444: outFormat = GL_RGBA; outType = GL_UNSIGNED_SHORT_4_4_4_4; break;
+	case IMAGE_FORMAT_RGBA5551: outFormat = GL_RGBA; outType = GL_UNSIGNED_SHORT_5_5_5_1; break;
+	default: outFormat = GL_RGBA; outType = GL_UNSIGNED_BYTE; break;
+	}
+}
+
+
+/********************* ATLAS ********************/
+/********************* ATLAS ********************/
+/********************* ATLAS ********************/
+// Every image having its own texture wastes a lot. Each one gets padded out
+// to a power of 2 (a 42x42 image takes a 64x64 texture), and each one needs
+// its own bind, which also splits up the batches (see addQuad). So instead,
+// the images that have been loaded but not drawn yet get packed together in
+// to one texture, an atlas, the first time one of them is drawn. The game
+// loads all its art up front, so it all ends up in one atlas.
+//
+// Everything in a texture has to be in the same format, so images in
+// different formats go in different atlases.
+//
+// The atlas texture is made empty, and then each image's pixels go straight
+// in to their spot in it, right out of the texture cache (or wherever they
+// were converted to). There's never a copy of the whole atlas in memory.
+//
+// The packing is simple shelves. The images go in tallest first, left to
+// right in rows, and a new row starts when one doesn't fit across. We try
+// each power of 2 width and keep the one that makes the smallest texture.
+static void buildAtlases()
+{
+	// the biggest texture we make. Anything bigger than this gets a
+	// texture all to itself (like every image used to)
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if ( maxSize > MAX_ATLAS_SIZE || maxSize <= 0 ) maxSize = MAX_ATLAS_SIZE;
+
+	// tallest first. There's never many, so a simple sort is fine
+	for ( int i=1 ; i<s_numPending ; i++ )
+	{
+		Image *img = s_pending[i];
+		int j = i;
+		while ( j > 0 && s_pending[j-1]->m_height < img->m_height )
+		{
+			s_pending[j] = s_pending[j-1];
+			j--;
+		}
+		s_pending[j] = img;
+	}
+
+	// one atlas at a time, until they're all in one
+	while ( s_numPending > 0 )
+	{
+		// this one's for images in the same format as the tallest one left
+		s_atlasFormat = s_pending[0]->m_pending->m_format;
+		s_atlasType = s_pending[0]->m_pending->m_type;
+
+		// find the width that fits the most images in the least texture
+		int bestWidth = 0;
+		int bestPlaced = 0;
+		int bestArea = 0;
+		for ( int width = 1 ; width <= maxSize ; width <<= 1 )
+		{
+			int usedWidth, usedHeight;
+			int placed = packShelves(width, maxSize, usedWidth, usedHeight);
+			int area = textureSize(usedWidth)*textureSize(usedHeight);
+			if ( placed > bestPlaced || (placed == bestPlaced && placed > 0 && area < bestArea) )
+			{
+				bestWidth = width;
+				bestPlaced = placed;
+				bestArea = area;
+			}
+		}
+
+		int atlasWidth, atlasHeight;
+		if ( bestPlaced == 0 )
+		{
+			// the tallest one is too big for an atlas (or it would have fit
+			// in an empty one). It gets its own texture
+			Image *img = s_pending[0];
+			s_placeX[0] = 0;
+			s_placeY[0] = 0;
+			for ( int i=1 ; i<s_numPending ; i++ )
+			{
+				s_placeX[i] = -1;
+			}
+			atlasWidth = img->m_width;
+			atlasHeight = img->m_height;
+		}
+		else
+		{
+			packShelves(bestWidth, maxSize, atlasWidth, atlasHeight);
+		}
+		makeAtlas(textureSize(atlasWidth), textureSize(atlasHeight));
+	}
+}
+
+// put the pending images on shelves in a texture this wide and at most
+// maxHeight tall. Where each one went is left in s_placeX/s_placeY, or -1 in
+// s_placeX if it didn't fit. Returns how many did.
+static int packShelves(int width, int maxHeight, int &outWidth, int &outHeight)
+{
+	int placed = 0;
+	int x = 0;
+	int shelfY = 0;
+	int shelfHeight = 0;
+	outWidth = 0;
+	outHeight = 0;
+	for ( int i=0 ; i<s_numPending ; i++ )
+	{
+		Image *img = s_pending[i];
+		s_placeX[i] = -1;
+		if ( img->m_pending->m_format != s_atlasFormat || img->m_pending->m_type != s_atlasType )
+		{
+			continue;
+		}
+
+		// start a new shelf if it doesn't fit across
+		if ( x + img->m_width > width )
+		{
+			x = 0;
+			shelfY += shelfHeight;
+			shelfHeight = 0;
+		}
+		if ( img->m_width > width || shelfY + img->m_height > maxHeight )
+		{
+			continue;
+		}
+
+		s_placeX[i] = x;
+		s_placeY[i] = shelfY;
+		placed++;
+		if ( x + img->m_width > outWidth ) outWidth = x + img->m_width;
+		if ( shelfY + img->m_height > outHeight ) outHeight = shelfY + img->m_height;
+
+		// leave a gap, so nothing that lands on the very edge of an image
+		// picks up its neighbour
+		x += img->m_width + ATLAS_PADDING;
+		if ( img->m_height + ATLAS_PADDING > shelfHeight ) shelfHeight = img->m_height + ATLAS_PADDING;
+	}
+	return placed;
+}
+
+// make the texture for the pending images that have a place, and take them
+// off the pending list
+static void makeAtlas(int width, int height)
+{
+	// Create an OpenGL texture for the atlas, with nothing in it yet.
+	// We used to build the whole atlas in memory first, because
+	// glTexImage2D wants all the pixels at once. But it's just as happy
+	// with none, and then we can fill it in a piece at a time. The gaps
+	// between the images are left as whatever was there, which is fine,
+	// since nothing is ever drawn from them.
+	AtlasTexture *atlas = new AtlasTexture();
+	atlas->m_numImages = 0;
+	glGenTextures(1, &atlas->m_name);
+	setTexture(atlas->m_name);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glTexImage2D(GL_TEXTURE_2D,
 		     0,
-		     GL_RGBA,
-		     pow2W, pow2H,
+		     s_atlasFormat,
+		     width, height,
 		     0,
-		     GL_RGBA,
-		     GL_UNSIGNED_BYTE,
-		     image->pixels);
+		     s_atlasFormat,
+		     s_atlasType,
+		     NULL);
 
-	// the SDL image we made is no longer needed
-	SDL_FreeSurface(image); 
+	int numLeft = 0;
+	for ( int i=0 ; i<s_numPending ; i++ )
+	{
+		Image *img = s_pending[i];
+		if ( s_placeX[i] < 0 )
+		{
+			// next time
+			s_pending[numLeft] = img;
+			s_placeX[numLeft] = -1;
+			numLeft++;
+			continue;
+		}
+		TextureFile *pixels = img->m_pending;
 
-	// we no longer need the SDL surface. We duplicated all the data from
-	// it and have our OGL surface all set up.
-	SDL_FreeSurface(surface);
+		// put the image's pixels in to its spot in the atlas. They're
+		// already in the atlas's format, with no gaps between the rows
+		// (and the unpack alignment is 1, see graphics_init), so it's all
+		// in one go.
+		glTexSubImage2D(GL_TEXTURE_2D,
+			0,
+			s_placeX[i], s_placeY[i],
+			img->m_width, img->m_height,
+			s_atlasFormat,
+			s_atlasType,
+			pixels->m_pixels);
+
+		// we wont be using the whole texture, just the image's
+		// part of it. So we note the texture coordinates needed to 
+		// end up using *only* that part when we draw it.
+		img->m_textureX = (GLfloat)s_placeX[i] / (GLfloat)width;
+		img->m_textureY = (GLfloat)s_placeY[i] / (GLfloat)height;
+		img->m_textureWidth = (GLfloat)img->m_width / (GLfloat)width;	
+		img->m_textureHeight = (GLfloat)img->m_height / (GLfloat)height;	
+		img->m_name = atlas->m_name;
+		img->m_atlas = atlas;
+		atlas->m_numImages++;
+
+		// we no longer need the pixels. OGL has its own copy.
+		delete pixels;
+		img->m_pending = NULL;
+	}
+	s_numPending = numLeft;
+}
+
+// how big a texture has to be to hold size pixels
+static int textureSize(int size)
+{
+	return s_bAnySizeTextures ? size : power_of_two(size);
 }
 
 // find the next power of 2 that is 
@@ -46,21 +46,90 @@ void drawImage(Image *img, int x, int y)
 	SDL_BlitSurface(img->m_surface, NULL, g_screen, &destRect);
 }
 
+// the static rects. SDL has nowhere else to keep them, so they're just
+// filled every frame like any other rect.
+static SDL_Rect s_staticRects[MAX_STATIC_RECTS];
+static int s_staticColors[MAX_STATIC_RECTS];
+static int s_numStaticRects = 0;
+
+void clearStaticRects()
+{
+	s_numStaticRects = 0;
+}
+
+void addStaticRect(int x, int y, int w, int h, int color)
+{
+	if ( s_numStaticRects == MAX_STATIC_RECTS )
+	{
+		printf("Too many static rects, the most is %d\n", MAX_STATIC_RECTS);
+		return;
+	}
+	SDL_Rect &r = s_staticRects[s_numStaticRects];
+	r.x = (Sint16)x;
+	r.y = (Sint16)y;
+	r.w = (Sint16)w;
+	r.h = (Sint16)h;
+	s_staticColors[s_numStaticRects] = color;
+	s_numStaticRects++;
+}
+
+void drawStaticRects(int offsetX, int offsetY)
+{
+	for ( int i=0 ; i<s_numStaticRects ; i++ )
+	{
+		SDL_Rect &r = s_staticRects[i];
+		fillRect(r.x - offsetX, r.y - offsetY, r.w, r.h, s_staticColors[i]);
+	}
+}
+
+// how many frames we've shown, and how long it took, for getPresentStats
+static Uint32 s_framesPresented = 0;
+static Uint32 s_presentBlockedMs = 0;
+
 // SDL doesn't actually blit until you call SDL_UpdateRect
 void frameDone()
 {
-	// update the screen
+	// update the screen. All the drawing already happened on the CPU, 
+	// so this is just copying it to the screen.
+	Uint32 start = SDL_GetTicks();
 	SDL_UpdateRect(g_screen, 0, 0, SCREEN_WIDTH, SCREEN_HEIGHT);    
+	s_presentBlockedMs += SDL_GetTicks() - start;
+	s_framesPresented++;
+}
+
+// SDL draws as it goes, so there's never more than one frame
+void setMaxFramesInFlight(int)
+{
 }
 
-Image *loadImage(const char *fileName)
+void getPresentStats(Uint32 &outFrames, Uint32 &outBlockedMs)
+{
+	outFrames = s_framesPresented;
+	outBlockedMs = s_presentBlockedMs;
+}
+
+// no OGL, no OGL calls
+void getGLCallStats(Uint32 &outFrameIssued, Uint32 &outFrameSkipped, Uint32 &outTotalIssued, Uint32 &outTotalSkipped)
+{
+	outFrameIssued = 0;
+	outFrameSkipped = 0;
+	outTotalIssued = 0;
+	outTotalSkipped = 0;
+}
+
+Image *loadImage(const char *fileName, int format, SDL_bool bDither)
 {
 	// simply instance an Image, and tell it to load.
 	Image *ret = new Image();
-	ret->load(fileName);
+	ret->load(fileName, format, bDither);
 	return ret;
 }
 
+// SDL keeps the images as they come out of SDL_image, so there's no cache
+void setTextureCacheDir(const char *)
+{
+}
+
 void freeImage(Image *img)
 {
 	delete img;
@@ -86,7 +155,9 @@ Image::~Image()
 
 // load an image into an SDL surface. The sent-in
 // parameter is the file name. 
-void Image::load(const char *fileName)
+// the format and bDither are for OGL. SDL just keeps the
+// surface the way SDL_image hands it to us.
+void Image::load(const char *fileName, int, SDL_bool)
 {
 	// this is really insanely easy. But broken into 
 	// a seperate function so it will be easy for you to find.
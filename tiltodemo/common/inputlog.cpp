@@ -0,0 +1,168 @@
+#include "inputlog.h"
+#include <string.h>
+
+// See inputlog.h for what this is for, and what the file looks like.
+// We write a byte at a time so the file comes out the same on any machine,
+// no matter which way around it keeps its ints.
+
+static const char MAGIC[4] = { 'T', 'I', 'L', 'T' };
+static const int HEADER_SIZE = 15;
+
+InputLog::InputLog()
+{
+	m_file = NULL;
+	m_flags = 0;
+	m_ballRadius = 0;
+	m_numBalls = 0;
+	m_level = 0;
+	m_data = NULL;
+	m_size = 0;
+	m_pos = 0;
+	m_start = 0;
+}
+
+InputLog::~InputLog()
+{
+	stopRecording();
+	delete [] m_data;
+}
+
+SDL_bool InputLog::startRecording(const char *fileName, int flags, int ballRadius, int numBalls, Uint32 level)
+{
+	stopRecording();
+
+	m_file = fopen(fileName, "wb");
+	if ( m_file == NULL )
+	{
+		printf("Could not open %s for recording\n", fileName);
+		return SDL_FALSE;
+	}
+
+	fwrite(MAGIC, 1, 4, m_file);
+	writeByte(VERSION);
+	writeByte(flags);
+	writeByte(ballRadius);
+	writeShort(numBalls & 0xffff);
+	writeShort((numBalls >> 16) & 0xffff);
+	writeShort((int)(level & 0xffff));
+	writeShort((int)(level >> 16));
+	return SDL_TRUE;
+}
+
+void InputLog::stopRecording()
+{
+	if ( m_file != NULL )
+	{
+		fclose(m_file);
+		m_file = NULL;
+	}
+}
+
+SDL_bool InputLog::isRecording()
+{
+	return m_file != NULL ? SDL_TRUE : SDL_FALSE;
+}
+
+void InputLog::recordTick(int ms)
+{
+	if ( m_file == NULL ) return;
+
+	// tick() never uses more than 100ms of a frame, but we save what
+	// actually happened and let it clamp on the way back in.
+	if ( ms < 0 ) ms = 0;
+	if ( ms > 0xffff ) ms = 0xffff;
+	writeByte(RECORD_TICK);
+	writeShort(ms);
+}
+
+void InputLog::recordAxis(int axis, int value)
+{
+	if ( m_file == NULL ) return;
+
+	writeByte(RECORD_AXIS + axis);
+	writeShort(value);
+}
+
+void InputLog::writeByte(int b)
+{
+	fputc(b & 0xff, m_file);
+}
+
+void InputLog::writeShort(int s)
+{
+	writeByte(s);
+	writeByte(s >> 8);
+}
+
+SDL_bool InputLog::load(const char *fileName)
+{
+	delete [] m_data;
+	m_data = NULL;
+	m_size = 0;
+
+	FILE *file = fopen(fileName, "rb");
+	if ( file == NULL )
+	{
+		printf("Could not open %s for playback\n", fileName);
+		return SDL_FALSE;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if ( size < HEADER_SIZE )
+	{
+		printf("%s is too short to be an input log\n", fileName);
+		fclose(file);
+		return SDL_FALSE;
+	}
+
+	m_data = new Uint8[size];
+	m_size = (int)fread(m_data, 1, size, file);
+	fclose(file);
+
+	if ( m_size < HEADER_SIZE || memcmp(m_data, MAGIC, 4) != 0 || m_data[4] != VERSION )
+	{
+		printf("%s is not an input log we can read\n", fileName);
+		return SDL_FALSE;
+	}
+
+	m_flags = m_data[5];
+	m_ballRadius = m_data[6];
+	m_numBalls = m_data[7] | (m_data[8] << 8) | (m_data[9] << 16) | (m_data[10] << 24);
+	m_level = (Uint32)m_data[11] | ((Uint32)m_data[12] << 8) | ((Uint32)m_data[13] << 16) | ((Uint32)m_data[14] << 24);
+	m_start = HEADER_SIZE;
+	rewind();
+	return SDL_TRUE;
+}
+
+SDL_bool InputLog::next(int &outType, int &outAxis, int &outValue)
+{
+	// every record is 3 bytes. A partial one at the end means the
+	// game didn't get to finish writing it, so we stop there.
+	if ( m_data == NULL || m_pos + 3 > m_size ) return SDL_FALSE;
+
+	int tag = m_data[m_pos];
+	int value = m_data[m_pos+1] | (m_data[m_pos+2] << 8);
+	m_pos += 3;
+
+	if ( tag == RECORD_TICK )
+	{
+		outType = RECORD_TICK;
+		outAxis = 0;
+		outValue = value;
+	}
+	else
+	{
+		// axis values are signed
+		outType = RECORD_AXIS;
+		outAxis = tag - RECORD_AXIS;
+		outValue = (Sint16)value;
+	}
+	return SDL_TRUE;
+}
+
+void InputLog::rewind()
+{
+	m_pos = m_start;
+}
@@ -0,0 +1,76 @@
+#ifndef __INPUTLOG__
+#define __INPUTLOG__
+
+#include "SDL.h"
+#include <stdio.h>
+
+// A recording of everything the player did in a game: every accelerometer
+// value that came in, and how long every tick was. Since the physics only
+// depends on those two things, playing the log back through GameLogic::tick
+// gives exactly the same game, ball for ball. That makes a real game session
+// in to a workload we can run over and over when profiling, and a check that
+// a change to the physics didn't change where the balls go.
+//
+// The file is a small header followed by records, all little endian:
+//   header: "TILT", version (1 byte), flags (1 byte), ball radius (1 byte),
+//           number of balls (4 bytes), level (4 bytes)
+//   tick:   0, then the tick's ms (2 bytes)
+//   axis:   1 + the accelerometer (ACCELEROMETER_X etc), then the value (2 bytes)
+// That's 3 bytes a record, which at 100 ticks a second is a few KB a second.
+// The level is the hash of the level file that was played (see
+// LevelStream::m_hash), or 0 for the built in level. The log is no good
+// without the level it was played on, so replay won't play it on any other.
+class InputLog
+{
+public:
+	static const int VERSION = 2;
+
+	// the kinds of records
+	static const int RECORD_TICK = 0;
+	static const int RECORD_AXIS = 1;
+
+	// the header flags
+	static const int FLAG_FIXED_STEP = 1;
+	static const int FLAG_BALL_COLLISIONS = 2;
+
+	InputLog();
+	~InputLog();
+
+	// recording. Returns false if the file can't be made
+	SDL_bool startRecording(const char *fileName, int flags, int ballRadius, int numBalls, Uint32 level);
+	void stopRecording();
+	SDL_bool isRecording();
+	void recordTick(int ms);
+	void recordAxis(int axis, int value);
+
+	// playback. load reads the whole log in to memory, so reading the file
+	// doesn't get counted as part of the game. Returns false if the file
+	// can't be read, or isn't a log.
+	SDL_bool load(const char *fileName);
+
+	// gets the next record. For a tick, outValue is the ms and outAxis
+	// isn't used. Returns false once we're out of records.
+	SDL_bool next(int &outType, int &outAxis, int &outValue);
+	void rewind();
+
+	// itnernals
+	void writeByte(int b);
+	void writeShort(int s);
+
+	// data
+	FILE *m_file; // the file we're recording to, or NULL
+
+	// the header, when playing back
+	int m_flags;
+	int m_ballRadius;
+	int m_numBalls;
+	Uint32 m_level;
+
+	// the records, when playing back
+	Uint8 *m_data;
+	int m_size;
+	int m_pos;
+	int m_start; // where the first record is
+};
+
+#endif
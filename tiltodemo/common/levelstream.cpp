@@ -0,0 +1,454 @@
+#include "levelstream.h"
+#include <string.h>
+
+// See levelstream.h for the big picture, and what the file looks like.
+//
+// When the level is opened we read through the whole file once, but all we
+// keep is where each chunk starts. After that, the only thing that reads the
+// file is the loader thread, which seeks straight to a chunk and reads just
+// that. The game thread asks for chunks by putting them in the queue, and
+// picks them up once the loader marks them ready. A chunk's blocks and pits
+// belong to the loader until then, and to the game thread after, so the only
+// thing the two ever share is the chunk states and the queue.
+
+static const int MAX_LINE = 256;
+
+LevelStream::LevelStream()
+{
+	m_file = NULL;
+	m_width = 0;
+	m_height = 0;
+	m_chunkSize = MIN_CHUNK_SIZE;
+	m_numCols = 0;
+	m_numRows = 0;
+	m_chunkOffsets = NULL;
+	m_startX = 0;
+	m_startY = 0;
+	memset(&m_exitRect, 0, sizeof(m_exitRect));
+	m_hash = 0;
+	m_numActive = 0;
+	m_needCol1 = -1;
+	m_needRow1 = -1;
+	m_needCol2 = -1;
+	m_needRow2 = -1;
+	m_thread = NULL;
+	m_lock = NULL;
+	m_wake = NULL;
+	m_loaded = NULL;
+	m_queueHead = 0;
+	m_queueCount = 0;
+	m_bQuit = SDL_FALSE;
+	m_numLoads = 0;
+	m_numWaits = 0;
+
+	for ( int i=0 ; i<MAX_CHUNKS ; i++ )
+	{
+		m_chunks[i].m_state = CHUNK_FREE;
+	}
+}
+
+LevelStream::~LevelStream()
+{
+	close();
+}
+
+SDL_bool LevelStream::open(const char *fileName)
+{
+	close();
+
+	FILE *file = fopen(fileName, "r");
+	if ( file == NULL )
+	{
+		printf("Could not open level %s\n", fileName);
+		return SDL_FALSE;
+	}
+
+	// go through the file a line at a time. We note where each line starts,
+	// so when we get to a chunk line we know where to come back to. Every
+	// line, comments and all, goes in to the hash (FNV-1a, like the replay
+	// checksum), so any change to the file changes it.
+	char line[MAX_LINE];
+	char word[16];
+	long offset = ftell(file);
+	m_hash = 2166136261u;
+	while ( fgets(line, MAX_LINE, file) != NULL )
+	{
+		long lineOffset = offset;
+		offset = ftell(file);
+		for ( const char *c = line ; *c != 0 ; c++ )
+		{
+			m_hash = (m_hash ^ (Uint8)*c) * 16777619u;
+		}
+		if ( sscanf(line, "%15s", word) != 1 || word[0] == '#' ) continue;
+
+		if ( strcmp(word, "level") == 0 )
+		{
+			if ( sscanf(line, "%*s %d %d %d", &m_width, &m_height, &m_chunkSize) != 3 ||
+				m_width <= 0 || m_height <= 0 || m_width > 32767 || m_height > 32767 ||
+				m_chunkSize < MIN_CHUNK_SIZE || m_chunkSize > MAX_CHUNK_SIZE || m_chunkOffsets != NULL )
+			{
+				printf("Bad level line in %s: %s", fileName, line);
+				break;
+			}
+			m_numCols = (m_width + m_chunkSize - 1)/m_chunkSize;
+			m_numRows = (m_height + m_chunkSize - 1)/m_chunkSize;
+			m_chunkOffsets = new long[m_numCols*m_numRows];
+			for ( int i=0 ; i<m_numCols*m_numRows ; i++ )
+			{
+				m_chunkOffsets[i] = -1;
+			}
+		}
+		else if ( m_chunkOffsets == NULL )
+		{
+			// everything else has to come after the level line
+			printf("%s doesn't start with a level line\n", fileName);
+			break;
+		}
+		else if ( strcmp(word, "start") == 0 )
+		{
+			sscanf(line, "%*s %d %d", &m_startX, &m_startY);
+		}
+		else if ( strcmp(word, "exit") == 0 )
+		{
+			int x, y, w, h;
+			if ( sscanf(line, "%*s %d %d %d %d", &x, &y, &w, &h) == 4 )
+			{
+				m_exitRect.x = (Sint16)x;
+				m_exitRect.y = (Sint16)y;
+				m_exitRect.w = (Uint16)w;
+				m_exitRect.h = (Uint16)h;
+			}
+		}
+		else if ( strcmp(word, "chunk") == 0 )
+		{
+			int col, row;
+			if ( sscanf(line, "%*s %d %d", &col, &row) != 2 || col < 0 || row < 0 || col >= m_numCols || row >= m_numRows )
+			{
+				printf("Bad chunk line in %s: %s", fileName, line);
+				continue;
+			}
+			if ( m_chunkOffsets[row*m_numCols + col] >= 0 )
+			{
+				printf("Chunk %d %d is in %s twice. Only the first one counts\n", col, row, fileName);
+				continue;
+			}
+			m_chunkOffsets[row*m_numCols + col] = lineOffset;
+		}
+
+		// the blocks and pits get read when their chunk is loaded
+	}
+
+	if ( m_chunkOffsets == NULL )
+	{
+		fclose(file);
+		return SDL_FALSE;
+	}
+	m_file = file;
+
+	// and start up the loader
+	m_lock = SDL_CreateMutex();
+	m_wake = SDL_CreateCond();
+	m_loaded = SDL_CreateCond();
+	m_bQuit = SDL_FALSE;
+	m_thread = SDL_CreateThread(threadMain, this);
+	if ( m_thread == NULL )
+	{
+		printf("Could not create level loader thread. Reason: %s\n", SDL_GetError());
+		close();
+		return SDL_FALSE;
+	}
+	return SDL_TRUE;
+}
+
+void LevelStream::close()
+{
+	if ( m_thread != NULL )
+	{
+		// tell the loader to go home. If it's in the middle of a
+		// chunk, it finishes that first.
+		SDL_LockMutex(m_lock);
+		m_bQuit = SDL_TRUE;
+		SDL_CondSignal(m_wake);
+		SDL_UnlockMutex(m_lock);
+		SDL_WaitThread(m_thread, NULL);
+		m_thread = NULL;
+	}
+	if ( m_lock != NULL )
+	{
+		SDL_DestroyCond(m_loaded);
+		SDL_DestroyCond(m_wake);
+		SDL_DestroyMutex(m_lock);
+		m_loaded = NULL;
+		m_wake = NULL;
+		m_lock = NULL;
+	}
+	if ( m_file != NULL )
+	{
+		fclose(m_file);
+		m_file = NULL;
+	}
+
+	delete [] m_chunkOffsets;
+	m_chunkOffsets = NULL;
+	for ( int i=0 ; i<MAX_CHUNKS ; i++ )
+	{
+		m_chunks[i].m_state = CHUNK_FREE;
+	}
+	m_numActive = 0;
+	m_needCol1 = -1;
+	m_needRow1 = -1;
+	m_needCol2 = -1;
+	m_needRow2 = -1;
+	m_queueHead = 0;
+	m_queueCount = 0;
+}
+
+SDL_bool LevelStream::isOpen()
+{
+	return m_file != NULL ? SDL_TRUE : SDL_FALSE;
+}
+
+SDL_bool LevelStream::update(int x, int y, int width, int height)
+{
+	// the chunks that can have something touching the rect. A thing's corner
+	// can be up to a chunk up or left of what it touches (see levelstream.h)
+	int col1, row1, col2, row2;
+	getChunkRange(x - m_chunkSize, y - m_chunkSize, x + width - 1, y + height - 1, col1, row1, col2, row2);
+
+	// most ticks, the ball is still over the same chunks as last time,
+	// and everything it needs is already here.
+	if ( col1 == m_needCol1 && row1 == m_needRow1 && col2 == m_needCol2 && row2 == m_needRow2 )
+	{
+		return SDL_FALSE;
+	}
+	m_needCol1 = col1;
+	m_needRow1 = row1;
+	m_needCol2 = col2;
+	m_needRow2 = row2;
+
+	SDL_LockMutex(m_lock);
+
+	// let go of the chunks we've gotten well away from. We hang on to the
+	// ones just past the ones we load ahead, so going back and forth over
+	// a chunk edge doesn't keep loading the same chunk over and over.
+	int keep = PREFETCH_CHUNKS + 1;
+	for ( int i=0 ; i<MAX_CHUNKS ; i++ )
+	{
+		Chunk &chunk = m_chunks[i];
+		if ( chunk.m_state != CHUNK_READY ) continue;
+		if ( chunk.m_col < col1 - keep || chunk.m_col > col2 + keep || chunk.m_row < row1 - keep || chunk.m_row > row2 + keep )
+		{
+			chunk.m_state = CHUNK_FREE;
+		}
+	}
+
+	// ask for what we need right now first, so the loader gets to those
+	// before the ones we're only loading ahead.
+	for ( int pass=0 ; pass<2 ; pass++ )
+	{
+		int extra = pass == 0 ? 0 : PREFETCH_CHUNKS;
+		for ( int row=row1-extra ; row<=row2+extra ; row++ )
+		{
+			for ( int col=col1-extra ; col<=col2+extra ; col++ )
+			{
+				if ( col < 0 || row < 0 || col >= m_numCols || row >= m_numRows ) continue;
+				if ( m_chunkOffsets[row*m_numCols + col] < 0 ) continue;
+				if ( findChunk(col, row) < 0 )
+				{
+					requestChunk(col, row);
+				}
+			}
+		}
+	}
+
+	// now the active chunks. Anything we need that the loader hasn't gotten
+	// to yet, we wait for. That should only happen when the ball moves faster
+	// than the loading ahead can keep up with, or right after the level opens.
+	m_numActive = 0;
+	for ( int row=row1 ; row<=row2 ; row++ )
+	{
+		for ( int col=col1 ; col<=col2 ; col++ )
+		{
+			if ( m_chunkOffsets[row*m_numCols + col] < 0 ) continue;
+			int index = findChunk(col, row);
+			if ( index < 0 ) continue; // out of room, already complained about
+			if ( m_chunks[index].m_state != CHUNK_READY )
+			{
+				m_numWaits++;
+				while ( m_chunks[index].m_state != CHUNK_READY )
+				{
+					SDL_CondWait(m_loaded, m_lock);
+				}
+			}
+			m_active[m_numActive++] = index;
+		}
+	}
+
+	SDL_UnlockMutex(m_lock);
+	return SDL_TRUE;
+}
+
+int LevelStream::getNumActive()
+{
+	return m_numActive;
+}
+
+LevelStream::Chunk *LevelStream::getActive(int index)
+{
+	return &m_chunks[m_active[index]];
+}
+
+void LevelStream::getChunkRange(int x1, int y1, int x2, int y2, int &outCol1, int &outRow1, int &outCol2, int &outRow2)
+{
+	// anything off the level is clamped in to the edge chunks
+	outCol1 = x1 < 0 ? 0 : x1/m_chunkSize;
+	outRow1 = y1 < 0 ? 0 : y1/m_chunkSize;
+	outCol2 = x2 < 0 ? 0 : x2/m_chunkSize;
+	outRow2 = y2 < 0 ? 0 : y2/m_chunkSize;
+	if ( outCol1 >= m_numCols ) outCol1 = m_numCols-1;
+	if ( outCol2 >= m_numCols ) outCol2 = m_numCols-1;
+	if ( outRow1 >= m_numRows ) outRow1 = m_numRows-1;
+	if ( outRow2 >= m_numRows ) outRow2 = m_numRows-1;
+}
+
+int LevelStream::findChunk(int col, int row)
+{
+	// there are only a few dozen slots, so we just look through them.
+	// This only happens when the ball crosses in to a new chunk.
+	for ( int i=0 ; i<MAX_CHUNKS ; i++ )
+	{
+		Chunk &chunk = m_chunks[i];
+		if ( chunk.m_state != CHUNK_FREE && chunk.m_col == col && chunk.m_row == row )
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+int LevelStream::requestChunk(int col, int row)
+{
+	// puts a chunk in the queue for the loader. m_lock has to be held.
+	// Returns the slot it'll be loaded in to, or -1 if there's no room.
+	int slot = -1;
+	for ( int i=0 ; i<MAX_CHUNKS && slot<0 ; i++ )
+	{
+		if ( m_chunks[i].m_state == CHUNK_FREE ) slot = i;
+	}
+
+	// no free slots. Let go of one we're hanging on to that isn't even
+	// close enough to load ahead.
+	for ( int i=0 ; i<MAX_CHUNKS && slot<0 ; i++ )
+	{
+		Chunk &chunk = m_chunks[i];
+		int extra = PREFETCH_CHUNKS;
+		if ( chunk.m_state == CHUNK_READY && (chunk.m_col < m_needCol1 - extra || chunk.m_col > m_needCol2 + extra ||
+			chunk.m_row < m_needRow1 - extra || chunk.m_row > m_needRow2 + extra) )
+		{
+			slot = i;
+		}
+	}
+
+	if ( slot < 0 )
+	{
+		printf("Out of room for level chunks (%d)\n", MAX_CHUNKS);
+		return -1;
+	}
+
+	Chunk &chunk = m_chunks[slot];
+	chunk.m_col = col;
+	chunk.m_row = row;
+	chunk.m_state = CHUNK_QUEUED;
+	m_queue[(m_queueHead + m_queueCount) % MAX_CHUNKS] = slot;
+	m_queueCount++;
+	SDL_CondSignal(m_wake);
+	return slot;
+}
+
+void LevelStream::loadChunk(Chunk &chunk)
+{
+	// runs on the loader thread, without the lock. Nobody else
+	// touches the chunk until we mark it ready.
+	chunk.m_numBlocks = 0;
+	chunk.m_numPits = 0;
+	int left = chunk.m_col*m_chunkSize;
+	int top = chunk.m_row*m_chunkSize;
+
+	// skip past the chunk line, then read up to the next chunk
+	char line[MAX_LINE];
+	char word[16];
+	fseek(m_file, m_chunkOffsets[chunk.m_row*m_numCols + chunk.m_col], SEEK_SET);
+	fgets(line, MAX_LINE, m_file);
+	while ( fgets(line, MAX_LINE, m_file) != NULL )
+	{
+		if ( sscanf(line, "%15s", word) != 1 || word[0] == '#' ) continue;
+		if ( strcmp(word, "chunk") == 0 ) break;
+
+		SDL_bool bBlock = strcmp(word, "block") == 0 ? SDL_TRUE : SDL_FALSE;
+		SDL_bool bPit = strcmp(word, "pit") == 0 ? SDL_TRUE : SDL_FALSE;
+		if ( !bBlock && !bPit ) continue;
+
+		int x, y, w, h;
+		if ( sscanf(line, "%*s %d %d %d %d", &x, &y, &w, &h) != 4 ||
+			x < left || y < top || x >= left + m_chunkSize || y >= top + m_chunkSize ||
+			w < 1 || h < 1 || w > m_chunkSize || h > m_chunkSize )
+		{
+			printf("Bad %s in chunk %d %d: %s", word, chunk.m_col, chunk.m_row, line);
+			continue;
+		}
+
+		SDL_Rect *rc = NULL;
+		if ( bBlock && chunk.m_numBlocks < MAX_CHUNK_BLOCKS )
+		{
+			rc = &chunk.m_blocks[chunk.m_numBlocks++];
+		}
+		else if ( bPit && chunk.m_numPits < MAX_CHUNK_PITS )
+		{
+			rc = &chunk.m_pits[chunk.m_numPits++];
+		}
+		else
+		{
+			printf("Too many %ss in chunk %d %d\n", word, chunk.m_col, chunk.m_row);
+			continue;
+		}
+		rc->x = (Sint16)x;
+		rc->y = (Sint16)y;
+		rc->w = (Uint16)w;
+		rc->h = (Uint16)h;
+	}
+}
+
+void LevelStream::work()
+{
+	SDL_LockMutex(m_lock);
+	for ( ;; )
+	{
+		while ( m_queueCount == 0 && !m_bQuit )
+		{
+			SDL_CondWait(m_wake, m_lock);
+		}
+		if ( m_bQuit ) break;
+
+		// take the next chunk off the queue and load it
+		Chunk &chunk = m_chunks[m_queue[m_queueHead]];
+		m_queueHead = (m_queueHead + 1) % MAX_CHUNKS;
+		m_queueCount--;
+		chunk.m_state = CHUNK_LOADING;
+
+		SDL_UnlockMutex(m_lock);
+		loadChunk(chunk);
+		SDL_LockMutex(m_lock);
+
+		chunk.m_state = CHUNK_READY;
+		m_numLoads++;
+		SDL_CondBroadcast(m_loaded);
+	}
+	SDL_UnlockMutex(m_lock);
+}
+
+int LevelStream::threadMain(void *data)
+{
+	LevelStream *stream = (LevelStream *)data;
+	stream->work();
+	return 0;
+}
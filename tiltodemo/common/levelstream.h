@@ -0,0 +1,143 @@
+#ifndef __LEVELSTREAM__
+#define __LEVELSTREAM__
+
+#include "SDL.h"
+#include <stdio.h>
+
+// A level that's too big to keep in memory all at once, or at least too big
+// to test the ball against all at once. The level is cut up in to square
+// chunks, and only the chunks near the camera are loaded. A thread in the
+// background reads chunks in from the file as the ball gets close to them,
+// and chunks the ball has left behind get thrown away, so how much memory
+// we use and how much work a tick takes depend on the size of the screen,
+// not the size of the level.
+//
+// The file is plain text, a thing per line. # starts a comment:
+//   level width height chunkSize
+//   start x y
+//   exit x y w h
+//   chunk col row
+//   block x y w h
+//   pit x y w h
+// level comes first. The blocks and pits after a chunk line are in that
+// chunk, and each one's top left corner has to be inside of it. None of them
+// can be bigger than a chunk. That way, anything that touches a rect has its
+// corner no more than a chunk up or left of it, which is how we know which
+// chunks to load. All the numbers are in pixels, from the top left of the level.
+class LevelStream
+{
+public:
+	// how big a chunk can be. With chunks at least this big, the chunks that
+	// are needed for the screen, plus the ones we load ahead, plus the ones
+	// we hang on to in case the ball comes back, fit in MAX_CHUNKS.
+	static const int MIN_CHUNK_SIZE = 256;
+	static const int MAX_CHUNK_SIZE = 1024;
+	static const int MAX_CHUNKS = 64;
+
+	// the most of each thing a chunk can have
+	static const int MAX_CHUNK_BLOCKS = 32;
+	static const int MAX_CHUNK_PITS = 16;
+
+	// how many chunks past the ones we need right now get loaded ahead of time
+	static const int PREFETCH_CHUNKS = 1;
+
+	// the most blocks and pits the active chunks can have between them. 
+	// There are never more than MAX_CHUNKS active, however spread out the
+	// balls are, so that's what the game has to have room for.
+	static const int MAX_ACTIVE_BLOCKS = MAX_CHUNKS*MAX_CHUNK_BLOCKS;
+	static const int MAX_ACTIVE_PITS = MAX_CHUNKS*MAX_CHUNK_PITS;
+
+	// what a chunk slot is up to
+	static const int CHUNK_FREE = 0;
+	static const int CHUNK_QUEUED = 1; // waiting for the loader
+	static const int CHUNK_LOADING = 2; // the loader is reading it
+	static const int CHUNK_READY = 3;
+
+	// one loaded chunk
+	struct Chunk
+	{
+		int m_col;
+		int m_row;
+		int m_state;
+		SDL_Rect m_blocks[MAX_CHUNK_BLOCKS];
+		int m_numBlocks;
+		SDL_Rect m_pits[MAX_CHUNK_PITS];
+		int m_numPits;
+	};
+
+	LevelStream();
+	~LevelStream();
+
+	// reads the level's header and notes where each chunk starts in the file,
+	// then starts up the loader. Returns false if the file can't be read, or
+	// isn't a level.
+	SDL_bool open(const char *fileName);
+	void close();
+	SDL_bool isOpen();
+
+	// called once a tick with the part of the level the balls might touch
+	// before the next call (the screen, and then some). Loads what's needed
+	// for it and starts loading what's around it. If something we need
+	// right now isn't loaded yet, this waits for it. Returns true if the
+	// active chunks (the ones that touch the rect) changed.
+	SDL_bool update(int x, int y, int width, int height);
+
+	// the active chunks, in the order they come in the level. Only good
+	// until the next update.
+	int getNumActive();
+	Chunk *getActive(int index);
+
+	// itnernals
+	void getChunkRange(int x1, int y1, int x2, int y2, int &outCol1, int &outRow1, int &outCol2, int &outRow2);
+	int findChunk(int col, int row);
+	int requestChunk(int col, int row);
+	void loadChunk(Chunk &chunk);
+	void work();
+	static int threadMain(void *data);
+
+	// data
+	FILE *m_file; // only the loader reads this once it's started
+	int m_width;
+	int m_height;
+	int m_chunkSize;
+	int m_numCols;
+	int m_numRows;
+	long *m_chunkOffsets; // where each chunk starts in the file, or -1 if it's empty
+	int m_startX;
+	int m_startY;
+	SDL_Rect m_exitRect;
+	Uint32 m_hash; // of every line in the file, so a replay can tell it has the same level (see InputLog)
+
+	// the chunks we have, or are getting
+	Chunk m_chunks[MAX_CHUNKS];
+
+	// the active chunks, as indexes in to m_chunks
+	int m_active[MAX_CHUNKS];
+	int m_numActive;
+
+	// the range of chunks that was needed last update, so we can tell
+	// when it hasn't changed
+	int m_needCol1;
+	int m_needRow1;
+	int m_needCol2;
+	int m_needRow2;
+
+	// the loader. m_lock guards the chunk states and the queue. m_wake
+	// tells the loader there's something in the queue, m_loaded tells
+	// update that a chunk came in.
+	SDL_Thread *m_thread;
+	SDL_mutex *m_lock;
+	SDL_cond *m_wake;
+	SDL_cond *m_loaded;
+	int m_queue[MAX_CHUNKS];
+	int m_queueHead;
+	int m_queueCount;
+	SDL_bool m_bQuit;
+
+	// stats. How many chunks got loaded, and how many times the game
+	// had to wait for one.
+	Uint32 m_numLoads;
+	Uint32 m_numWaits;
+};
+
+#endif
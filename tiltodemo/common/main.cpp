@@ -20,14 +20,89 @@
 #include "sound.h"
 #include "gamelogic.h"
 #include "PDL.h"
+#include <string.h>
+#include <stdlib.h>
 
 // main: the entry point. Birth of all applications. From here begins the 
 // great adventure. 
 int main(int argc, char *argv[])
 {
-	// eliminate unused formal parameter warnings.
-	argc;
-	argv;
+	// look for the stress scene options. "-balls 5000" runs the level
+	// with 5000 balls instead of just the player's, and "-threads 4" 
+	// spreads them over 4 threads (the default is one per CPU).
+	// "-record game.log" saves everything the player does, and 
+	// "-replay game.log" plays it back without a screen (see inputlog.h).
+	// "-level biglevel.txt" plays a level from a file instead of the built
+	// in one (see levelstream.h). A replay needs the same -level as the game,
+	// and won't play without it.
+	// "-inflight 3" lets OGL queue up to 3 frames (see setMaxFramesInFlight).
+	// "-texcache dir" keeps the decoded images in dir instead of the app's
+	// data directory (see texturefile.h).
+	// "-stats" prints how hard the physics and drawing worked on the way out.
+	int numBalls = 1;
+	int numThreads = 0;
+	const char *recordFile = NULL;
+	const char *replayFile = NULL;
+	const char *levelFile = NULL;
+	int framesInFlight = 0;
+	const char *textureCacheDir = NULL;
+	SDL_bool bPrintStats = SDL_FALSE;
+	for ( int i=1 ; i<argc ; i++ )
+	{
+		if ( strcmp(argv[i], "-stats") == 0 )
+		{
+			bPrintStats = SDL_TRUE;
+		}
+		else if ( i+1 >= argc )
+		{
+			// the rest all need something after them
+			break;
+		}
+		else if ( strcmp(argv[i], "-balls") == 0 )
+		{
+			numBalls = atoi(argv[++i]);
+		}
+		else if ( strcmp(argv[i], "-threads") == 0 )
+		{
+			numThreads = atoi(argv[++i]);
+		}
+		else if ( strcmp(argv[i], "-record") == 0 )
+		{
+			recordFile = argv[++i];
+		}
+		else if ( strcmp(argv[i], "-replay") == 0 )
+		{
+			replayFile = argv[++i];
+		}
+		else if ( strcmp(argv[i], "-level") == 0 )
+		{
+			levelFile = argv[++i];
+		}
+		else if ( strcmp(argv[i], "-inflight") == 0 )
+		{
+			framesInFlight = atoi(argv[++i]);
+		}
+		else if ( strcmp(argv[i], "-texcache") == 0 )
+		{
+			textureCacheDir = argv[++i];
+		}
+	}
+
+	// a replay is just the physics. No screen, no sound, no accelerometer,
+	// so we only init enough of SDL to get SDL_GetTicks going.
+	if ( replayFile != NULL )
+	{
+		SDL_Init(0);
+		GameLogic *game = new GameLogic();
+		if ( levelFile != NULL )
+		{
+			game->setLevelFile(levelFile);
+		}
+		int replayResult = game->replay(replayFile, numThreads);
+		delete game;
+		SDL_Quit();
+		return replayResult;
+	}
 
 	// init SDL. See sdl_init.cpp for this function
 	int result = initSDL(); 
@@ -44,6 +119,20 @@ int main(int argc, char *argv[])
 		// is amiss.
 		error = error; 
 	}
+	if ( framesInFlight > 0 )
+	{
+		setMaxFramesInFlight(framesInFlight);
+	}
+
+	// the decoded images are cached in the app's own data directory, which
+	// we can always write to. Not next to the images: the app is installed
+	// read only. If PDL can't tell us where that is, we go without.
+	char dataDir[256];
+	if ( textureCacheDir == NULL && PDL_GetDataFilePath("texcache", dataDir, sizeof(dataDir)) == PDL_NOERROR )
+	{
+		textureCacheDir = dataDir;
+	}
+	setTextureCacheDir(textureCacheDir);
 
 	// now init the sounds. This function is in sound.cpp
 	initSound();
@@ -54,6 +143,19 @@ int main(int argc, char *argv[])
 	// have already been torn down by the time GameLogic's destructor
 	// is called, and chaos ensues.)
 	GameLogic *game = new GameLogic();
+	if ( numBalls > 1 )
+	{
+		game->setNumBalls(numBalls, numThreads);
+	}
+	if ( recordFile != NULL )
+	{
+		game->setRecordFile(recordFile);
+	}
+	if ( levelFile != NULL )
+	{
+		game->setLevelFile(levelFile);
+	}
+	game->m_bPrintStats = bPrintStats;
 	game->run();
 	delete game;
 
@@ -0,0 +1,348 @@
+#include "texturefile.h"
+
+#if USE_OGL
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#else
+#include <direct.h>
+#endif
+
+// See texturefile.h for what this is for, and what the file looks like.
+
+static const char MAGIC[4] = { 'T', 'T', 'E', 'X' };
+
+struct TextureFileHeader
+{
+	char m_magic[4];
+	Uint32 m_version;
+	Uint32 m_sourceTime;
+	Uint32 m_sourceSize;
+	Uint32 m_settings;
+	Uint32 m_width;
+	Uint32 m_height;
+	Uint32 m_format;
+	Uint32 m_type;
+};
+
+// the longest path we'll make for a cache file
+static const int MAX_PATH_LENGTH = 512;
+
+static char s_cacheDir[MAX_PATH_LENGTH] = "";
+
+// the 4x4 ordered dither pattern. Each pixel in a 4x4 block rounds at a
+// different point, so the block as a whole comes out to the right color.
+static const int DITHER[4][4] =
+{
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 }
+};
+
+// squeeze an 8 bit value down to the given number of bits. round is
+// how far up to push it before cutting off, from 0 to 254, and 127 rounds
+// to the nearest.
+static inline int reduce(int value, int bits, int round)
+{
+	int top = (1 << bits) - 1;
+	return (value*top + round) / 255;
+}
+
+TextureFile::TextureFile()
+{
+	m_width = 0;
+	m_height = 0;
+	m_format = GL_RGBA;
+	m_type = GL_UNSIGNED_BYTE;
+	m_settings = 0;
+	m_pixels = NULL;
+	m_map = NULL;
+	m_mapSize = 0;
+}
+
+TextureFile::~TextureFile()
+{
+	close();
+}
+
+SDL_bool TextureFile::open(const char *sourceFile)
+{
+	close();
+
+	// no source, no cache. The cache can't tell us the source is gone.
+	struct stat source;
+	if ( stat(sourceFile, &source) != 0 )
+	{
+		return SDL_FALSE;
+	}
+
+	char path[MAX_PATH_LENGTH];
+	if ( !getCachePath(sourceFile, path, sizeof(path)) )
+	{
+		return SDL_FALSE;
+	}
+
+#ifndef WIN32
+	// map the whole thing in. The pixels never get copied, OGL reads them
+	// straight out of the file (or the OS's copy of it, anyway)
+	int fd = ::open(path, O_RDONLY);
+	if ( fd < 0 )
+	{
+		return SDL_FALSE;
+	}
+	struct stat cache;
+	if ( fstat(fd, &cache) != 0 || cache.st_size < (off_t)sizeof(TextureFileHeader) )
+	{
+		::close(fd);
+		return SDL_FALSE;
+	}
+	m_mapSize = (size_t)cache.st_size;
+	m_map = mmap(NULL, m_mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);
+	if ( m_map == MAP_FAILED )
+	{
+		m_map = NULL;
+		m_mapSize = 0;
+		return SDL_FALSE;
+	}
+#else
+	// no mmap on windows, so we just read it in
+	FILE *file = fopen(path, "rb");
+	if ( file == NULL )
+	{
+		return SDL_FALSE;
+	}
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if ( size < (long)sizeof(TextureFileHeader) )
+	{
+		fclose(file);
+		return SDL_FALSE;
+	}
+	m_mapSize = (size_t)size;
+	m_map = new Uint8[m_mapSize];
+	m_mapSize = fread(m_map, 1, m_mapSize, file);
+	fclose(file);
+#endif
+
+	// make sure it's ours, and up to date, and all there
+	TextureFileHeader header;
+	memcpy(&header, m_map, sizeof(header));
+	m_width = (int)header.m_width;
+	m_height = (int)header.m_height;
+	m_format = (GLenum)header.m_format;
+	m_type = (GLenum)header.m_type;
+	m_settings = header.m_settings;
+	if ( m_mapSize < sizeof(header) || memcmp(header.m_magic, MAGIC, 4) != 0 || header.m_version != VERSION ||
+		header.m_sourceTime != (Uint32)source.st_mtime || header.m_sourceSize != (Uint32)source.st_size ||
+		m_mapSize != sizeof(header) + (size_t)getPitch()*m_height )
+	{
+		close();
+		return SDL_FALSE;
+	}
+
+	m_pixels = (Uint8 *)m_map + sizeof(header);
+	return SDL_TRUE;
+}
+
+void TextureFile::create(int width, int height, GLenum format, GLenum type)
+{
+	close();
+	m_width = width;
+	m_height = height;
+	m_format = format;
+	m_type = type;
+	m_pixels = new Uint8[getPitch()*height];
+}
+
+SDL_bool TextureFile::save(const char *sourceFile)
+{
+	struct stat source;
+	if ( m_pixels == NULL || stat(sourceFile, &source) != 0 )
+	{
+		return SDL_FALSE;
+	}
+
+	TextureFileHeader header;
+	memcpy(header.m_magic, MAGIC, 4);
+	header.m_version = VERSION;
+	header.m_sourceTime = (Uint32)source.st_mtime;
+	header.m_sourceSize = (Uint32)source.st_size;
+	header.m_settings = m_settings;
+	header.m_width = (Uint32)m_width;
+	header.m_height = (Uint32)m_height;
+	header.m_format = (Uint32)m_format;
+	header.m_type = (Uint32)m_type;
+
+	// write it to the side and then move it in to place, so if we get
+	// killed half way through there's never half a cache file
+	char path[MAX_PATH_LENGTH];
+	char tempPath[MAX_PATH_LENGTH + 4];
+	if ( !getCachePath(sourceFile, path, sizeof(path)) )
+	{
+		return SDL_FALSE;
+	}
+	sprintf(tempPath, "%s.tmp", path);
+	FILE *file = fopen(tempPath, "wb");
+	if ( file == NULL )
+	{
+		// the first time, the cache directory might not be there yet.
+		// (only the last part of it gets made, the rest has to be there)
+#ifndef WIN32
+		mkdir(s_cacheDir, 0755);
+#else
+		_mkdir(s_cacheDir);
+#endif
+		file = fopen(tempPath, "wb");
+	}
+	if ( file == NULL )
+	{
+		printf("Could not write the texture cache %s\n", path);
+		return SDL_FALSE;
+	}
+	size_t size = (size_t)getPitch()*m_height;
+	SDL_bool bWritten = (SDL_bool)(fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(m_pixels, 1, size, file) == size);
+	bWritten = (SDL_bool)(fclose(file) == 0 && bWritten);
+#ifdef WIN32
+	// windows won't rename over a file
+	remove(path);
+#endif
+	if ( !bWritten || rename(tempPath, path) != 0 )
+	{
+		printf("Could not write the texture cache %s\n", path);
+		remove(tempPath);
+		return SDL_FALSE;
+	}
+	return SDL_TRUE;
+}
+
+void TextureFile::convert(TextureFile &rgba, GLenum format, GLenum type, SDL_bool bDither)
+{
+	create(rgba.m_width, rgba.m_height, format, type);
+	for ( int y=0 ; y<m_height ; y++ )
+	{
+		const Uint8 *in = rgba.m_pixels + y*rgba.getPitch();
+		Uint8 *out = m_pixels + y*getPitch();
+		Uint16 *out16 = (Uint16 *)out;
+		for ( int x=0 ; x<m_width ; x++, in += 4 )
+		{
+			// where this pixel rounds. The middle, or somewhere
+			// from the pattern
+			int round = bDither ? DITHER[y & 3][x & 3]*16 + 7 : 127;
+			if ( type == GL_UNSIGNED_BYTE )
+			{
+				// nothing lost, so nothing to dither
+				int bytes = (format == GL_RGBA) ? 4 : 3;
+				memcpy(out + x*bytes, in, bytes);
+			}
+			else if ( type == GL_UNSIGNED_SHORT_5_6_5 )
+			{
+				out16[x] = (Uint16)((reduce(in[0], 5, round) << 11) | (reduce(in[1], 6, round) << 5) | reduce(in[2], 5, round));
+			}
+			else if ( type == GL_UNSIGNED_SHORT_4_4_4_4 )
+			{
+				out16[x] = (Uint16)((reduce(in[0], 4, round) << 12) | (reduce(in[1], 4, round) << 8) | (reduce(in[2], 4, round) << 4) | reduce(in[3], 4, round));
+			}
+			else
+			{
+				// one bit of alpha doesn't dither well. It's there or not.
+				out16[x] = (Uint16)((reduce(in[0], 5, round) << 11) | (reduce(in[1], 5, round) << 6) | (reduce(in[2], 5, round) << 1) | (in[3] >= 128 ? 1 : 0));
+			}
+		}
+	}
+}
+
+int TextureFile::getAlphaKind()
+{
+	int kind = ALPHA_NONE;
+	for ( int y=0 ; y<m_height ; y++ )
+	{
+		const Uint8 *in = m_pixels + y*getPitch();
+		for ( int x=0 ; x<m_width ; x++, in += 4 )
+		{
+			if ( in[3] == 255 ) continue;
+			if ( in[3] != 0 ) return ALPHA_FULL;
+			kind = ALPHA_ONE_BIT;
+		}
+	}
+	return kind;
+}
+
+void TextureFile::close()
+{
+	if ( m_map != NULL )
+	{
+#ifndef WIN32
+		munmap(m_map, m_mapSize);
+#else
+		delete [] (Uint8 *)m_map;
+#endif
+		m_map = NULL;
+		m_mapSize = 0;
+	}
+	else
+	{
+		delete [] m_pixels;
+	}
+	m_pixels = NULL;
+}
+
+int TextureFile::getBytesPerPixel()
+{
+	if ( m_type != GL_UNSIGNED_BYTE )
+	{
+		// all the 16 bit ones
+		return 2;
+	}
+	switch ( m_format )
+	{
+	case GL_RGBA: return 4;
+	case GL_RGB: return 3;
+	case GL_LUMINANCE_ALPHA: return 2;
+	default: return 1;
+	}
+}
+
+int TextureFile::getPitch()
+{
+	return m_width*getBytesPerPixel();
+}
+
+void TextureFile::setCacheDir(const char *dir)
+{
+	if ( dir == NULL )
+	{
+		s_cacheDir[0] = 0;
+		return;
+	}
+	strncpy(s_cacheDir, dir, sizeof(s_cacheDir) - 1);
+	s_cacheDir[sizeof(s_cacheDir) - 1] = 0;
+}
+
+SDL_bool TextureFile::getCachePath(const char *sourceFile, char *outPath, int size)
+{
+	// no cache directory, no cache
+	if ( s_cacheDir[0] == 0 )
+	{
+		return SDL_FALSE;
+	}
+
+	// in the cache directory, by the source's file name
+	const char *name = sourceFile;
+	for ( const char *p = sourceFile ; *p != 0 ; p++ )
+	{
+		if ( *p == '/' || *p == '\\' ) name = p + 1;
+	}
+	SDL_snprintf(outPath, size, "%s/%s.tex", s_cacheDir, name);
+	return SDL_TRUE;
+}
+
+#endif // USE_OGL
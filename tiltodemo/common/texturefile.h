@@ -0,0 +1,96 @@
+#ifndef __TEXTUREFILE__
+#define __TEXTUREFILE__
+
+#include "SDL.h"
+#include "globals.h"
+
+#if USE_OGL
+#include <GLES/gl.h>
+
+// An image's pixels, already decoded and converted to what OGL takes, and
+// the texture cache that keeps them between runs. Decoding the PNGs and JPGs
+// takes most of the time it takes us to start up, so the first time an image
+// is loaded, what we get out of the decoder is saved in the cache directory
+// (ball.png's goes in ball.png.tex). After that the cache file is mapped 
+// straight in to memory and handed to OGL, with no decoding and no copying.
+// The cache directory is the app's data directory (see main.cpp), never
+// next to the images: the app is installed read only on the device, and on
+// the desktop that'd be the source tree.
+//
+// A cache file is only used if it was made from the source file as it is
+// now, which we tell by the source's size and modified time. Delete the
+// cache files and they'll be made again. They're only meant for the machine
+// that made them, so everything is in its byte order:
+//   header: "TTEX", version, source modified time, source size, settings,
+//           width, height, OGL format, OGL type (4 bytes each)
+//   then the pixels, a row at a time from the top, with no padding
+class TextureFile
+{
+public:
+	static const int VERSION = 2;
+
+	TextureFile();
+	~TextureFile();
+
+	// maps in the cache file for sourceFile. Returns false if there isn't
+	// one, or it's out of date, or it isn't a cache file we can read.
+	SDL_bool open(const char *sourceFile);
+
+	// makes room for pixels of this size and format, to be filled in
+	void create(int width, int height, GLenum format, GLenum type);
+
+	// saves the pixels as the cache file for sourceFile
+	SDL_bool save(const char *sourceFile);
+
+	// fills these pixels in from RGBA ones (GL_RGBA, GL_UNSIGNED_BYTE), in
+	// one of the formats OGL has: GL_RGBA or GL_RGB with GL_UNSIGNED_BYTE,
+	// GL_RGB with GL_UNSIGNED_SHORT_5_6_5, or GL_RGBA with
+	// GL_UNSIGNED_SHORT_4_4_4_4 or GL_UNSIGNED_SHORT_5_5_5_1. Going to 16
+	// bits makes smooth colors come out in bands. bDither breaks the bands
+	// up with a pattern, which looks a lot more like the real thing. 
+	void convert(TextureFile &rgba, GLenum format, GLenum type, SDL_bool bDither);
+
+	// what the alpha in RGBA pixels is like. All 255, all 0 or 255, or
+	// anything else.
+	static const int ALPHA_NONE = 0;
+	static const int ALPHA_ONE_BIT = 1;
+	static const int ALPHA_FULL = 2;
+	int getAlphaKind();
+
+	// lets go of the pixels
+	void close();
+
+	// how many bytes a pixel takes, and a row
+	int getBytesPerPixel();
+	int getPitch();
+
+	// where the cache files go. It's made if it isn't there. NULL (to
+	// start with) turns the cache off: open never finds anything, and 
+	// save doesn't save.
+	static void setCacheDir(const char *dir);
+
+	// itnernals
+	static SDL_bool getCachePath(const char *sourceFile, char *outPath, int size);
+
+	// data
+	int m_width;
+	int m_height;
+	GLenum m_format;
+	GLenum m_type;
+
+	// whatever the maker wants to remember about how the pixels were
+	// made, so it can tell if the cache is what it would make now
+	Uint32 m_settings;
+
+	// the pixels. If they came from open, they're mapped from the file,
+	// and are read only.
+	Uint8 *m_pixels;
+
+	// itnernals
+	void *m_map; // the whole file, if it's mapped
+	size_t m_mapSize;
+};
+
+#endif // USE_OGL
+
+#endif
@@ -0,0 +1,268 @@
+#include "threadpool.h"
+
+#if WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+// See threadpool.h for the big picture. Note that the Pre and Pixi only have
+// one core, so there the game runs with a single worker and this never makes
+// a thread at all. It's here for the stress scenes, and for seeing how the
+// physics scales on machines with more cores.
+
+ThreadPool::ThreadPool()
+{
+	m_numWorkers = 1;
+	m_job = NULL;
+	m_count = 0;
+	m_chunkSize = 1;
+	m_lock = NULL;
+	m_wake = NULL;
+	m_done = NULL;
+	m_generation = 0;
+	m_numBusy = 0;
+	m_bQuit = SDL_FALSE;
+
+	for ( int i=0 ; i<MAX_WORKERS ; i++ )
+	{
+		m_threads[i] = NULL;
+		m_queues[i].m_lock = NULL;
+		m_queues[i].m_begin = 0;
+		m_queues[i].m_end = 0;
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	stop();
+}
+
+void ThreadPool::start(int numWorkers)
+{
+	stop();
+
+	if ( numWorkers <= 0 ) numWorkers = getNumCPUs();
+	if ( numWorkers > MAX_WORKERS ) numWorkers = MAX_WORKERS;
+	if ( numWorkers < 1 ) numWorkers = 1;
+	m_numWorkers = numWorkers;
+
+	// with just the one worker, there's nothing to set up.
+	// parallelFor will do everything on the calling thread.
+	if ( m_numWorkers == 1 ) return;
+
+	m_lock = SDL_CreateMutex();
+	m_wake = SDL_CreateCond();
+	m_done = SDL_CreateCond();
+	m_bQuit = SDL_FALSE;
+	for ( int i=0 ; i<m_numWorkers ; i++ )
+	{
+		m_queues[i].m_lock = SDL_CreateMutex();
+	}
+
+	// worker 0 is whoever calls parallelFor. Make threads for the rest.
+	// m_generation carries on from the last time we were started, so the
+	// new threads start out at whatever it is now. Otherwise they'd think
+	// the last job was a new one and go run it again.
+	SDL_LockMutex(m_lock);
+	int generation = m_generation;
+	SDL_UnlockMutex(m_lock);
+	for ( int i=1 ; i<m_numWorkers ; i++ )
+	{
+		m_threadStarts[i].m_pool = this;
+		m_threadStarts[i].m_worker = i;
+		m_threadStarts[i].m_generation = generation;
+		m_threads[i] = SDL_CreateThread(threadMain, &m_threadStarts[i]);
+		if ( m_threads[i] == NULL )
+		{
+			// carry on with what we got
+			printf("Could not create worker thread. Reason: %s\n", SDL_GetError());
+			m_numWorkers = i;
+			break;
+		}
+	}
+}
+
+void ThreadPool::stop()
+{
+	if ( m_lock != NULL )
+	{
+		// wake everybody up and tell them to go home
+		SDL_LockMutex(m_lock);
+		m_bQuit = SDL_TRUE;
+		SDL_CondBroadcast(m_wake);
+		SDL_UnlockMutex(m_lock);
+
+		for ( int i=1 ; i<MAX_WORKERS ; i++ )
+		{
+			if ( m_threads[i] != NULL )
+			{
+				SDL_WaitThread(m_threads[i], NULL);
+				m_threads[i] = NULL;
+			}
+		}
+
+		SDL_DestroyCond(m_done);
+		SDL_DestroyCond(m_wake);
+		SDL_DestroyMutex(m_lock);
+		m_done = NULL;
+		m_wake = NULL;
+		m_lock = NULL;
+	}
+
+	for ( int i=0 ; i<MAX_WORKERS ; i++ )
+	{
+		if ( m_queues[i].m_lock != NULL )
+		{
+			SDL_DestroyMutex(m_queues[i].m_lock);
+			m_queues[i].m_lock = NULL;
+		}
+	}
+	m_numWorkers = 1;
+}
+
+int ThreadPool::getNumWorkers()
+{
+	return m_numWorkers;
+}
+
+void ThreadPool::parallelFor(ParallelJob *job, int count, int chunkSize)
+{
+	if ( count <= 0 ) return;
+	if ( chunkSize < 1 ) chunkSize = 1;
+
+	// no threads, or not enough work to be worth waking them up? Just do it.
+	int numChunks = (count + chunkSize - 1)/chunkSize;
+	if ( m_numWorkers == 1 || numChunks == 1 )
+	{
+		job->run(0, count, 0);
+		return;
+	}
+
+	m_job = job;
+	m_count = count;
+	m_chunkSize = chunkSize;
+
+	// hand each worker an even share of the chunks to start with. Nobody
+	// is awake yet, so we don't need the queue locks for this.
+	for ( int i=0 ; i<m_numWorkers ; i++ )
+	{
+		m_queues[i].m_begin = (numChunks*i)/m_numWorkers;
+		m_queues[i].m_end = (numChunks*(i+1))/m_numWorkers;
+	}
+
+	// and they're off
+	SDL_LockMutex(m_lock);
+	m_numBusy = m_numWorkers;
+	m_generation++;
+	SDL_CondBroadcast(m_wake);
+	SDL_UnlockMutex(m_lock);
+
+	// do our share
+	work(0);
+
+	// then wait for the stragglers
+	SDL_LockMutex(m_lock);
+	while ( m_numBusy > 0 )
+	{
+		SDL_CondWait(m_done, m_lock);
+	}
+	SDL_UnlockMutex(m_lock);
+
+	m_job = NULL;
+}
+
+void ThreadPool::work(int worker)
+{
+	// keep taking chunks until there are none left anywhere
+	int chunk;
+	while ( takeChunk(worker, chunk) )
+	{
+		int begin = chunk*m_chunkSize;
+		int end = begin + m_chunkSize;
+		if ( end > m_count ) end = m_count;
+		m_job->run(begin, end, worker);
+	}
+
+	// let parallelFor know we're finished
+	SDL_LockMutex(m_lock);
+	m_numBusy--;
+	if ( m_numBusy == 0 )
+	{
+		SDL_CondSignal(m_done);
+	}
+	SDL_UnlockMutex(m_lock);
+}
+
+SDL_bool ThreadPool::takeChunk(int worker, int &outChunk)
+{
+	// first try our own queue, from the back
+	WorkerQueue &own = m_queues[worker];
+	SDL_LockMutex(own.m_lock);
+	if ( own.m_begin < own.m_end )
+	{
+		own.m_end--;
+		outChunk = own.m_end;
+		SDL_UnlockMutex(own.m_lock);
+		return SDL_TRUE;
+	}
+	SDL_UnlockMutex(own.m_lock);
+
+	// ours is empty. Go looking for somebody else's, starting
+	// with our neighbour so the thieves spread out.
+	for ( int i=1 ; i<m_numWorkers ; i++ )
+	{
+		WorkerQueue &victim = m_queues[(worker+i)%m_numWorkers];
+		SDL_LockMutex(victim.m_lock);
+		if ( victim.m_begin < victim.m_end )
+		{
+			outChunk = victim.m_begin;
+			victim.m_begin++;
+			SDL_UnlockMutex(victim.m_lock);
+			return SDL_TRUE;
+		}
+		SDL_UnlockMutex(victim.m_lock);
+	}
+
+	return SDL_FALSE;
+}
+
+int ThreadPool::threadMain(void *data)
+{
+	ThreadStart *threadStart = (ThreadStart *)data;
+	ThreadPool *pool = threadStart->m_pool;
+
+	int seenGeneration = threadStart->m_generation;
+	for ( ;; )
+	{
+		// sleep until there's a new job, or it's time to quit
+		SDL_LockMutex(pool->m_lock);
+		while ( pool->m_generation == seenGeneration && !pool->m_bQuit )
+		{
+			SDL_CondWait(pool->m_wake, pool->m_lock);
+		}
+		seenGeneration = pool->m_generation;
+		SDL_bool bQuit = pool->m_bQuit;
+		SDL_UnlockMutex(pool->m_lock);
+
+		if ( bQuit ) break;
+
+		pool->work(threadStart->m_worker);
+	}
+
+	return 0;
+}
+
+int ThreadPool::getNumCPUs()
+{
+	// SDL 1.2 has no way to ask this, so we ask the OS
+#if WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwNumberOfProcessors;
+#else
+	long numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+	if ( numCPUs < 1 ) return 1;
+	return (int)numCPUs;
+#endif
+}
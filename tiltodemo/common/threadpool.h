@@ -0,0 +1,93 @@
+#ifndef __THREADPOOL__
+#define __THREADPOOL__
+
+#include "SDL.h"
+
+// A small work-stealing thread pool built on SDL threads. The work is a
+// range of items (balls, in our case) chopped in to chunks. Each worker starts
+// out with its own run of chunks, and works through them from the back. When
+// it runs out, it steals chunks from the front of some other worker's run.
+// That keeps everybody busy even when some chunks take longer than others.
+//
+// SDL doesn't give us atomic operations, so each worker's run is guarded
+// by its own mutex. A worker only ever fights over that lock when somebody
+// is stealing from it, which is rare compared to the work in a chunk.
+
+// the interface for work handed to the pool. run() is called with
+// each chunk, from whichever thread ends up doing that chunk.
+class ParallelJob
+{
+public:
+	virtual ~ParallelJob() {}
+	virtual void run(int begin, int end, int worker) = 0;
+};
+
+class ThreadPool
+{
+public:
+	// the most threads (counting the calling thread) we'll use
+	static const int MAX_WORKERS = 16;
+
+	ThreadPool();
+	~ThreadPool();
+
+	// fires up the worker threads. The thread that calls parallelFor
+	// does its share of the work too, so numWorkers-1 threads get made.
+	// send in 0 to get one worker per CPU.
+	void start(int numWorkers);
+	void stop();
+
+	// runs job over the items 0 to count-1, in chunks of chunkSize, and
+	// returns once all of them are done.
+	void parallelFor(ParallelJob *job, int count, int chunkSize);
+
+	int getNumWorkers();
+
+	// itnernals
+	void work(int worker);
+	SDL_bool takeChunk(int worker, int &outChunk);
+	static int threadMain(void *data);
+	static int getNumCPUs();
+
+	// each worker's run of chunks. The owner takes from m_end,
+	// thieves take from m_begin.
+	struct WorkerQueue
+	{
+		SDL_mutex *m_lock;
+		int m_begin;
+		int m_end;
+	};
+
+	// what gets sent to each thread when it's made. m_generation is the
+	// job it starts out having seen, so a pool that's started again doesn't
+	// look like it has a job waiting.
+	struct ThreadStart
+	{
+		ThreadPool *m_pool;
+		int m_worker;
+		int m_generation;
+	};
+
+	// data
+	int m_numWorkers;
+	SDL_Thread *m_threads[MAX_WORKERS];
+	ThreadStart m_threadStarts[MAX_WORKERS];
+	WorkerQueue m_queues[MAX_WORKERS];
+
+	// the current job
+	ParallelJob *m_job;
+	int m_count;
+	int m_chunkSize;
+
+	// m_lock guards everything below. m_generation goes up by one for
+	// each job, which is how the workers know there's something new to do.
+	// m_numBusy is the number of workers that haven't finished the job yet.
+	SDL_mutex *m_lock;
+	SDL_cond *m_wake;
+	SDL_cond *m_done;
+	int m_generation;
+	int m_numBusy;
+	SDL_bool m_bQuit;
+};
+
+#endif
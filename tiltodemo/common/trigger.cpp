@@ -0,0 +1,247 @@
+#include "trigger.h"
+#include "geometry.h"
+#include <string.h>
+
+// See trigger.h for the big picture. The grid here is built the same way as
+// the one for the collide walls (see CollideGrid::buildList), just with plain
+// indexes in the cells instead of copies of the walls. A trigger that
+// covers several cells goes in each of them.
+
+TriggerSet::TriggerSet()
+{
+	m_numTriggers = 0;
+	m_originX = 0;
+	m_originY = 0;
+	m_numCols = 0;
+	m_numRows = 0;
+	m_cellStart = NULL;
+	m_cellTriggers = NULL;
+}
+
+TriggerSet::~TriggerSet()
+{
+	delete [] m_cellStart;
+	delete [] m_cellTriggers;
+}
+
+int TriggerSet::add(int type, int x, int y, int width, int height)
+{
+	if ( m_numTriggers >= MAX_TRIGGERS ) return -1;
+
+	int trigger = m_numTriggers;
+	m_rects[trigger].x = (Sint16)x;
+	m_rects[trigger].y = (Sint16)y;
+	m_rects[trigger].w = (Uint16)width;
+	m_rects[trigger].h = (Uint16)height;
+	m_types[trigger] = type;
+	m_numTriggers++;
+	return trigger;
+}
+
+void TriggerSet::clear()
+{
+	m_numTriggers = 0;
+}
+
+void TriggerSet::build(int x, int y, int width, int height)
+{
+	// size the grid to cover the playfield, rounding up
+	m_originX = x;
+	m_originY = y;
+	m_numCols = (width + CELL_SIZE - 1)/CELL_SIZE;
+	m_numRows = (height + CELL_SIZE - 1)/CELL_SIZE;
+	if ( m_numCols < 1 ) m_numCols = 1;
+	if ( m_numRows < 1 ) m_numRows = 1;
+	int numCells = m_numCols*m_numRows;
+
+	delete [] m_cellStart;
+	m_cellStart = new int[numCells + 1];
+	for ( int c=0 ; c<=numCells ; c++ )
+	{
+		m_cellStart[c] = 0;
+	}
+
+	// first pass: count the triggers in each cell
+	int total = 0;
+	for ( int i=0 ; i<m_numTriggers ; i++ )
+	{
+		int col1, row1, col2, row2;
+		getCellRange(m_rects[i], col1, row1, col2, row2);
+		for ( int row=row1 ; row<=row2 ; row++ )
+		{
+			for ( int col=col1 ; col<=col2 ; col++ )
+			{
+				m_cellStart[row*m_numCols + col + 1]++;
+				total++;
+			}
+		}
+	}
+
+	// turn the counts in to start positions
+	for ( int c=0 ; c<numCells ; c++ )
+	{
+		m_cellStart[c+1] += m_cellStart[c];
+	}
+
+	// second pass: drop each trigger in to its cells. Going through them
+	// in order means each cell's list is sorted by index, for free.
+	// m_cellStart[c] is used as the cursor, and gets put back below.
+	delete [] m_cellTriggers;
+	m_cellTriggers = new Uint16[total > 0 ? total : 1];
+	for ( int i=0 ; i<m_numTriggers ; i++ )
+	{
+		int col1, row1, col2, row2;
+		getCellRange(m_rects[i], col1, row1, col2, row2);
+		for ( int row=row1 ; row<=row2 ; row++ )
+		{
+			for ( int col=col1 ; col<=col2 ; col++ )
+			{
+				m_cellTriggers[m_cellStart[row*m_numCols + col]++] = (Uint16)i;
+			}
+		}
+	}
+	for ( int c=numCells ; c>0 ; c-- )
+	{
+		m_cellStart[c] = m_cellStart[c-1];
+	}
+	m_cellStart[0] = 0;
+}
+
+int TriggerSet::queryPoint(int x, int y, int *outHits, int maxHits)
+{
+	if ( m_cellStart == NULL ) return 0;
+
+	// a point is only ever in the one cell, so there's no need
+	// to worry about finding the same trigger twice.
+	int cell = getCell(y - m_originY, m_numRows)*m_numCols + getCell(x - m_originX, m_numCols);
+	int numHits = 0;
+	for ( int i=m_cellStart[cell] ; i<m_cellStart[cell+1] && numHits<maxHits ; i++ )
+	{
+		int trigger = m_cellTriggers[i];
+		if ( ptInRect(x, y, &m_rects[trigger]) )
+		{
+			outHits[numHits++] = trigger;
+		}
+	}
+	return numHits;
+}
+
+int TriggerSet::querySegment(double x1, double y1, double x2, double y2, int *outHits, double *outTimes, int maxHits)
+{
+	if ( m_cellStart == NULL ) return 0;
+
+	// the cells covered by the box around the movement
+	double minX = x1 < x2 ? x1 : x2;
+	double maxX = x1 < x2 ? x2 : x1;
+	double minY = y1 < y2 ? y1 : y2;
+	double maxY = y1 < y2 ? y2 : y1;
+	int col1 = getCell((int)minX - m_originX, m_numCols);
+	int col2 = getCell((int)maxX - m_originX, m_numCols);
+	int row1 = getCell((int)minY - m_originY, m_numRows);
+	int row2 = getCell((int)maxY - m_originY, m_numRows);
+
+	// a trigger that covers more than one of the cells would get found in
+	// each of them, so we note the ones we've already looked at.
+	Uint32 seen[MASK_WORDS];
+	memset(seen, 0, ((m_numTriggers + 31) >> 5)*sizeof(Uint32));
+
+	int numHits = 0;
+	for ( int row=row1 ; row<=row2 ; row++ )
+	{
+		for ( int col=col1 ; col<=col2 ; col++ )
+		{
+			int cell = row*m_numCols + col;
+			for ( int i=m_cellStart[cell] ; i<m_cellStart[cell+1] ; i++ )
+			{
+				int trigger = m_cellTriggers[i];
+				Uint32 bit = 1u << (trigger & 31);
+				if ( seen[trigger >> 5] & bit ) continue;
+				seen[trigger >> 5] |= bit;
+
+				double time;
+				if ( numHits < maxHits && segmentInRect(x1, y1, x2, y2, m_rects[trigger], time) )
+				{
+					outHits[numHits] = trigger;
+					outTimes[numHits] = time;
+					numHits++;
+				}
+			}
+		}
+	}
+	return numHits;
+}
+
+int TriggerSet::getType(int trigger)
+{
+	return m_types[trigger];
+}
+
+SDL_Rect *TriggerSet::getRect(int trigger)
+{
+	return &m_rects[trigger];
+}
+
+int TriggerSet::getCount()
+{
+	return m_numTriggers;
+}
+
+void TriggerSet::getCellRange(SDL_Rect &rc, int &outCol1, int &outRow1, int &outCol2, int &outRow2)
+{
+	// the last pixel inside the rect is at x+w-1 (see ptInRect)
+	outCol1 = getCell(rc.x - m_originX, m_numCols);
+	outCol2 = getCell(rc.x + rc.w - 1 - m_originX, m_numCols);
+	outRow1 = getCell(rc.y - m_originY, m_numRows);
+	outRow2 = getCell(rc.y + rc.h - 1 - m_originY, m_numRows);
+}
+
+int TriggerSet::getCell(int pos, int numCells)
+{
+	// pos is measured from the grid's origin. Anything off the
+	// playfield is clamped in to the edge cells
+	if ( pos < 0 ) return 0;
+	if ( pos >= numCells*CELL_SIZE ) return numCells-1;
+	return pos/CELL_SIZE;
+}
+
+SDL_bool TriggerSet::segmentInRect(double x1, double y1, double x2, double y2, SDL_Rect &rc, double &outTime)
+{
+	// clip the movement to the rect one direction at a time. What's left
+	// of it, from tEnter to tExit, is the part that's inside. 
+	double tEnter = 0.0;
+	double tExit = 1.0;
+	double start[2] = { x1, y1 };
+	double delta[2] = { x2 - x1, y2 - y1 };
+	double rectMin[2] = { (double)rc.x, (double)rc.y };
+	double rectMax[2] = { (double)(rc.x + rc.w), (double)(rc.y + rc.h) };
+	for ( int axis=0 ; axis<2 ; axis++ )
+	{
+		if ( delta[axis] == 0.0 )
+		{
+			// not moving this way, so it's either in the whole time or never.
+			// The far edge isn't part of the rect (see ptInRect)
+			if ( start[axis] < rectMin[axis] || start[axis] >= rectMax[axis] ) return SDL_FALSE;
+			continue;
+		}
+
+		double t1 = (rectMin[axis] - start[axis])/delta[axis];
+		double t2 = (rectMax[axis] - start[axis])/delta[axis];
+		if ( t1 > t2 ) { double t = t1; t1 = t2; t2 = t; }
+		if ( t1 > tEnter ) tEnter = t1;
+		if ( t2 < tExit ) tExit = t2;
+		if ( tEnter > tExit ) return SDL_FALSE;
+	}
+
+	// if all that's left is a single point, the movement just touches
+	// an edge or a corner. That only counts if it's one of the edges
+	// that's part of the rect.
+	if ( tEnter == tExit )
+	{
+		double x = x1 + delta[0]*tEnter;
+		double y = y1 + delta[1]*tEnter;
+		if ( x >= rectMax[0] || y >= rectMax[1] ) return SDL_FALSE;
+	}
+
+	outTime = tEnter;
+	return SDL_TRUE;
+}
@@ -0,0 +1,73 @@
+#ifndef __TRIGGER__
+#define __TRIGGER__
+
+#include "SDL.h"
+
+// Trigger volumes are the parts of the level that do something when the
+// ball's center is inside of them, but don't stop it: the pits and the exit,
+// and whatever else comes along later. Each one is just a rect and a type.
+// The type is whatever the game wants it to be; TriggerSet never looks at it.
+//
+// The rects are kept in one flat array, and indexed by a uniform grid
+// laid over the playfield, same as the collide walls (see CollideGrid).
+// Asking what the ball is touching only looks at the triggers in the ball's
+// cell, so a level full of pits costs about the same as a level with one.
+class TriggerSet
+{
+public:
+	// the most triggers we can hold, and the size of a grid cell in pixels.
+	// That's every pit that a streamed level can have loaded at once (see
+	// LevelStream::MAX_ACTIVE_PITS), and then some.
+	static const int MAX_TRIGGERS = 2048;
+	static const int CELL_SIZE = 32;
+	static const int MASK_WORDS = MAX_TRIGGERS/32;
+
+	TriggerSet();
+	~TriggerSet();
+
+	// adds a trigger. Returns its index, or -1 if we're full.
+	int add(int type, int x, int y, int width, int height);
+	void clear();
+
+	// index the triggers over the part of the playfield with its top left
+	// at (x,y) and of the given size. This has to be done after the triggers
+	// are added, and before they're queried.
+	void build(int x, int y, int width, int height);
+
+	// fills outHits with the index of every trigger the point is inside
+	// of, lowest index first. Returns the number of hits, which is never
+	// more than maxHits. Inside means the same thing it does for ptInRect.
+	int queryPoint(int x, int y, int *outHits, int maxHits);
+
+	// same idea, but for everything a movement from (x1,y1) to (x2,y2) 
+	// passes through on the way, in no particular order. outTimes gets how
+	// far along the movement (0 to 1) it goes in to each trigger. This is how a ball moving fast
+	// enough to jump clean over a pit in one step still falls in.
+	int querySegment(double x1, double y1, double x2, double y2, int *outHits, double *outTimes, int maxHits);
+
+	int getType(int trigger);
+	SDL_Rect *getRect(int trigger);
+	int getCount();
+
+	// itnernals
+	void getCellRange(SDL_Rect &rc, int &outCol1, int &outRow1, int &outCol2, int &outRow2);
+	int getCell(int pos, int numCells);
+	SDL_bool segmentInRect(double x1, double y1, double x2, double y2, SDL_Rect &rc, double &outTime);
+
+	// data
+	SDL_Rect m_rects[MAX_TRIGGERS];
+	int m_types[MAX_TRIGGERS];
+	int m_numTriggers;
+
+	// the grid. The triggers in cell c are m_cellTriggers[m_cellStart[c]] up
+	// to (but not including) m_cellTriggers[m_cellStart[c+1]]. Its top 
+	// left corner is at m_originX, m_originY
+	int m_originX;
+	int m_originY;
+	int m_numCols;
+	int m_numRows;
+	int *m_cellStart;
+	Uint16 *m_cellTriggers;
+};
+
+#endif
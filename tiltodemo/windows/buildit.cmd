@@ -1,4 +1,19 @@
-arm-none-linux-gnueabi-g++ -o tiltodemo ..\common\accelerometer.cpp ..\common\collision.cpp ..\common\gamelogic.cpp ..\common\geometry.cpp ..\common\graphics_ogl.cpp ..\common\graphics_sdl.cpp ..\common\main.cpp ..\common\sdl_init.cpp ..\common\sound.cpp "-I%PalmPDK%\include" "-I%PalmPDK%\include\SDL" "-L%PalmPDK%\device\lib" -Wl,--allow-shlib-undefined -lSDL -lSDL_net -lSDL_image -lSDL_mixer -lpdl -lGLES_CM
+@rem Set the device you want to build for to 1
+@rem Use Pixi to allow running on either device
+set PRE=0
+set PIXI=1
 
+set DEVICEOPTS=
+
+@rem The Pre's Cortex-A8 has NEON, which the collision code uses when it's turned on
+if %PRE% equ 1 (
+   set DEVICEOPTS=-mcpu=cortex-a8 -mfpu=neon -mfloat-abi=softfp
+)
+
+if %PIXI% equ 1 (
+   set DEVICEOPTS=-mcpu=arm1136jf-s -mfpu=vfp -mfloat-abi=softfp
+)
+
+arm-none-linux-gnueabi-g++ %DEVICEOPTS% -o tiltodemo ..\common\accelerometer.cpp ..\common\collision.cpp ..\common\gamelogic.cpp ..\common\geometry.cpp ..\common\graphics_ogl.cpp ..\common\graphics_sdl.cpp ..\common\inputlog.cpp ..\common\levelstream.cpp ..\common\main.cpp ..\common\sdl_init.cpp ..\common\sound.cpp ..\common\texturefile.cpp ..\common\threadpool.cpp ..\common\trigger.cpp "-I%PalmPDK%\include" "-I%PalmPDK%\include\SDL" "-L%PalmPDK%\device\lib" -Wl,--allow-shlib-undefined -lSDL -lSDL_net -lSDL_image -lSDL_mixer -lpdl -lGLES_CM
 
 